@@ -0,0 +1,185 @@
+// Wakasagi: A* search
+// ----------------------------------
+
+#include "astar.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+constexpr int MAX_F        = 255; // g and f are stored in a byte
+
+static int nibble(const Position &pos, Square sq)
+{
+    Piece p = pos.peek_piece_at(sq);
+    if (p.side == Black && p.type <= Soldier) {
+        return 1 + p.type;
+    }
+    return p.side == NO_COLOR ? 0 : 8;
+}
+
+static PackedPosition pack(const Position &pos)
+{
+    PackedPosition pp = { { 0, 0 } };
+    for (Square sq : BoardView(pos.pieces())) {
+        pp.half[sq / 16] |= uint64_t(nibble(pos, sq)) << (4 * (sq % 16));
+    }
+    return pp;
+}
+
+// Rebuilds a position from the puzzle by only touching squares that changed
+static void unpack(const Position &root, const PackedPosition &rootState, const PackedPosition &pp, Position &pos)
+{
+    pos = root;
+    for (int i = 0; i < 2; i += 1) {
+        uint64_t diff = rootState.half[i] ^ pp.half[i];
+        while (diff) {
+            int n     = __builtin_ctzll(diff) / 4;
+            Square sq = Square(i * 16 + n);
+            int code  = (pp.half[i] >> (4 * n)) & 0xF;
+            if (code == 0) {
+                pos.remove_piece_at(sq);
+            } else {
+                pos.place_piece_at(Piece(Black, PieceType(code - 1)), sq);
+            }
+            diff &= ~(uint64_t(0xF) << (4 * n));
+        }
+    }
+}
+
+static uint64_t hash(const PackedPosition &pp)
+{
+    uint64_t h = pp.half[0] * 0x9E3779B97F4A7C15ULL ^ pp.half[1];
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    return h ^ (h >> 32);
+}
+
+// Each node costs its own size plus two closed set slots
+AStarResult astar(Position &root, size_t memory, const Budget &budget, int upperBound)
+{
+    AStarResult res;
+
+    size_t capacity = memory / (sizeof(AStarNode) + 2 * sizeof(uint32_t));
+    capacity        = std::min<size_t>(capacity, NO_NODE - 1);
+    size_t tableSize = 1;
+    while (tableSize < 2 * capacity) {
+        tableSize <<= 1;
+    }
+    if (capacity == 0) {
+        res.outOfMemory = true;
+        return res;
+    }
+
+    // Slots hold pool index + 1, 0 is empty. calloc() gets fresh zero
+    // pages from the OS, so only the part we touch costs anything.
+    std::unique_ptr<AStarNode[]> pool(new AStarNode[capacity]);
+    std::unique_ptr<uint32_t, decltype(&free)> closed(
+        static_cast<uint32_t *>(calloc(tableSize, sizeof(uint32_t))), &free
+    );
+    if (!closed) {
+        res.outOfMemory = true;
+        return res;
+    }
+    std::vector<uint32_t> buckets[MAX_F + 1];
+    size_t used = 0;
+
+    // Finds the slot of a state, or the empty slot where it should go
+    uint32_t *table = closed.get();
+    auto lookup = [&](const PackedPosition &pp) -> uint32_t & {
+        size_t i = hash(pp) & (tableSize - 1);
+        while (table[i] != 0 && !(pool[table[i] - 1].state == pp)) {
+            i = (i + 1) & (tableSize - 1);
+        }
+        return table[i];
+    };
+
+    PackedPosition rootState = pack(root);
+    int h                    = BoardView(root.pieces(Red)).to_vector().size() + find_table_dist(root);
+    if (h >= std::min(upperBound, MAX_F)) {
+        res.lowerBound = std::min(h, INF);
+        return res;
+    }
+    pool[0] = { rootState, NO_NODE, Move(0), 0, uint8_t(h) };
+    lookup(rootState) = 1;
+    buckets[h].push_back(0);
+    used = 1;
+
+    Position pos;
+    int f = h;
+    while (true) {
+        // Lowest f first, newest (usually deepest) first among equals
+        while (f < MAX_F && buckets[f].empty()) {
+            f += 1;
+        }
+        res.lowerBound = f;
+        if (f >= MAX_F) {
+            res.lowerBound = upperBound; // nothing left to expand
+            break;
+        }
+        if (f >= upperBound) {
+            break;
+        }
+        uint32_t idx = buckets[f].back();
+        buckets[f].pop_back();
+        AStarNode node = pool[idx];
+        if (node.f != f) {
+            continue; // stale, was reached again by a shorter path
+        }
+
+        res.nodes += 1;
+        if (budget.expired(res.nodes)) {
+            break;
+        }
+
+        unpack(root, rootState, node.state, pos);
+        if (pos.winner() == Black) {
+            res.found = true;
+            for (uint32_t i = idx; pool[i].parent != NO_NODE; i = pool[i].parent) {
+                res.path.push_back(pool[i].move);
+            }
+            std::reverse(res.path.begin(), res.path.end());
+            break;
+        }
+
+        int g = node.g + 1;
+        MoveList mvs(pos);
+        for (Move mv : mvs) {
+            Position next_pos(pos);
+            if (!next_pos.do_move(mv)) {
+                continue;
+            }
+            int h = BoardView(next_pos.pieces(Red)).to_vector().size() + find_table_dist(next_pos);
+            if (h >= INF || g + h >= std::min(upperBound, MAX_F)) {
+                continue;
+            }
+
+            PackedPosition pp = pack(next_pos);
+            uint32_t &slot    = lookup(pp);
+            if (slot != 0) {
+                AStarNode &old = pool[slot - 1];
+                if (old.g <= g) {
+                    continue;
+                }
+                // Shorter way in: reopen it
+                old.parent = idx;
+                old.move   = mv;
+                old.g      = g;
+                old.f      = g + h;
+                buckets[g + h].push_back(slot - 1);
+                continue;
+            }
+
+            if (used == capacity) {
+                res.outOfMemory = true;
+                return res;
+            }
+            pool[used] = { pp, idx, mv, uint8_t(g), uint8_t(g + h) };
+            slot       = used + 1;
+            buckets[g + h].push_back(used);
+            used += 1;
+        }
+    }
+    return res;
+}
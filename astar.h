@@ -0,0 +1,61 @@
+// Wakasagi: A* search
+// ----------------------------------
+// IDA* expands the whole tree again each time the threshold goes up.
+// A* expands every position once, at the price of remembering them all.
+
+#ifndef ASTAR_H
+#define ASTAR_H
+
+#include "solver.h"
+
+#include <vector>
+
+/*
+ * A position in 16 bytes, relative to the puzzle it came from.
+ * One nibble per square:
+ *   0      empty
+ *   1 ~ 7  black General ~ Soldier
+ *   8      the piece the puzzle had there (a red piece not captured yet,
+ *          a duck or a face-down piece; none of them ever move)
+ */
+struct PackedPosition {
+    uint64_t half[2];
+
+    bool operator==(const PackedPosition &other) const
+    {
+        return half[0] == other.half[0] && half[1] == other.half[1];
+    }
+};
+
+struct AStarNode {
+    PackedPosition state;
+    uint32_t parent; // index in the pool
+    Move move;       // from the parent
+    uint8_t g;
+    uint8_t f;
+};
+
+struct AStarResult {
+    std::vector<Move> path;
+    bool found      = false;
+    bool outOfMemory = false;
+    int lowerBound  = 0; // the f being expanded when the search ended
+    uint64_t nodes  = 0;
+};
+
+/*
+ * Solves the puzzle with A*.
+ * Nodes come from a fixed pool, the open list is an array of buckets by f
+ * and the closed set is an open-addressed hash table of pool indices.
+ *
+ * @param   root        The puzzle
+ * @param   memory      Bytes the pool and the closed set may take
+ * @param   budget      Stop when it expires
+ * @param   upperBound  Only look for solutions shorter than this
+ *
+ * @returns The solution if one was found. Otherwise lowerBound is still a
+ *          proven bound, and outOfMemory tells whether the pool ran out.
+ */
+AStarResult astar(Position &root, size_t memory, const Budget &budget, int upperBound = INF);
+
+#endif
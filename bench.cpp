@@ -0,0 +1,937 @@
+// Wakasagi: benchmarks
+// ----------------------------------
+
+#include "bench.h"
+#include "generator.h"
+#include "perf.h"
+#include "record.h"
+#include "mcts.h"
+#include "search.h"
+#include "solver.h"
+#include "validator.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <sched.h>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct Puzzle {
+    std::string name;
+    std::string fen;
+};
+
+struct BenchResult {
+    std::string name;
+    std::string fen;
+    int length;
+    bool optimal;
+    uint64_t nodes;
+    double ms;
+    std::string perf; // JSON, empty without --perf
+};
+
+// Set with --perf if the kernel lets us count anything
+static PerfCounters *counters = nullptr;
+
+static void perf_start()
+{
+    if (counters) {
+        counters->start();
+    }
+}
+
+static std::string perf_stop(uint64_t work)
+{
+    if (!counters) {
+        return "";
+    }
+    counters->stop();
+    return counters->json(work);
+}
+
+// What perf_summary() reports, when that isn't the last run
+static PerfCounters::Values perf_snapshot()
+{
+    return counters ? counters->snapshot() : PerfCounters::Values {};
+}
+
+static void perf_restore(const PerfCounters::Values &v)
+{
+    if (counters) {
+        counters->restore(v);
+    }
+}
+
+// The counters that tell the most, for the tables on stderr
+static void perf_summary(uint64_t work)
+{
+    if (!counters || !work) {
+        return;
+    }
+    fprintf(stderr, "%24s", "");
+    if (counters->available(PERF_CYCLES) && counters->available(PERF_INSTRUCTIONS)) {
+        fprintf(stderr, " ipc %.2f", (double)counters->value(PERF_INSTRUCTIONS) / std::max<uint64_t>(1, counters->value(PERF_CYCLES)));
+    }
+    const char *names[PERF_EVENT_NB] = { "cycles", "instr", "l1d", "llc", "br-miss" };
+    for (int e = 0; e < PERF_EVENT_NB; e += 1) {
+        if (counters->available(PerfEvent(e))) {
+            fprintf(stderr, " %s/node %.2f", names[e], (double)counters->value(PerfEvent(e)) / work);
+        }
+    }
+    fprintf(stderr, "\n");
+}
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Option values, with parse_count()/parse_real(). Whatever doesn't parse
+// or is out of [lo, hi] is reported, and the caller stops with status 1.
+template<typename T>
+static bool count_option(const char *name, const char *value, T &out, uint64_t lo = 0, uint64_t hi = UINT32_MAX)
+{
+    uint64_t n;
+    if (!parse_count(value, n) || n < lo || n > hi) {
+        error << "Bad value \"" << value << "\" for " << name << "\n";
+        return false;
+    }
+    out = n;
+    return true;
+}
+
+static bool real_option(const char *name, const char *value, double &out)
+{
+    if (!parse_real(value, out) || out < 0) {
+        error << "Bad value \"" << value << "\" for " << name << "\n";
+        return false;
+    }
+    return true;
+}
+
+// --hash, well past any table worth having: a typo shouldn't ask for terabytes
+constexpr uint64_t MAX_HASH_MB = 65536;
+
+// Lines are "<ranks> <side> <name>", # starts a comment.
+// Record files (see record.h) work too, their puzzles are named by index.
+static bool read_corpus(const char *path, std::vector<Puzzle> &puzzles)
+{
+    if (RecordReader::is_record_file(path)) {
+        RecordReader records;
+        if (!records.open(path)) {
+            return false;
+        }
+        char fen[FEN_BUFFER_SIZE];
+        for (size_t i = 0; i < records.records(); i += 1) {
+            size_t n = record_to_fen(records[i], fen);
+            puzzles.push_back({ "rec-" + std::to_string(i), std::string(fen, n) });
+        }
+        return true;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        error << "Can't open corpus \"" << path << "\"\n";
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream ss(line.substr(0, line.find('#')));
+        std::string ranks, side, name;
+        if (!(ss >> ranks)) {
+            continue;
+        }
+        if (!(ss >> side >> name)) {
+            error << "Corpus line without a name: \"" << line << "\"\n";
+            return false;
+        }
+        puzzles.push_back({ name, ranks + " " + side });
+    }
+    return true;
+}
+
+// Just enough JSON to read our own output back
+static std::string json_string(const std::string &line, const char *key)
+{
+    std::string k = std::string("\"") + key + "\":\"";
+    size_t at     = line.find(k);
+    if (at == std::string::npos) {
+        return "";
+    }
+    at += k.size();
+    return line.substr(at, line.find('"', at) - at);
+}
+
+static double json_number(const std::string &line, const char *key)
+{
+    std::string k = std::string("\"") + key + "\":";
+    size_t at     = line.find(k);
+    return at == std::string::npos ? -1 : atof(line.c_str() + at + k.size());
+}
+
+static void print_json(const BenchResult &r)
+{
+    double nps = r.ms > 0 ? r.nodes / (r.ms / 1e3) : 0;
+    printf("{\"name\":\"%s\",\"fen\":\"%s\",\"length\":%d,\"optimal\":%s,\"nodes\":%llu,\"ms\":%.3f,\"nps\":%.0f%s%s}\n",
+           r.name.c_str(), r.fen.c_str(), r.length, r.optimal ? "true" : "false",
+           (unsigned long long)r.nodes, r.ms, nps, r.perf.empty() ? "" : ",\"perf\":", r.perf.c_str());
+}
+
+// Time differences below this are noise
+constexpr double MIN_MS_REGRESSION = 1.0;
+
+static int bench_solve(int argc, char *argv[])
+{
+    if (argc < 1) {
+        error << "Usage: wakabench solve CORPUS [--baseline FILE] [--threshold PCT] [--time-threshold PCT] [--repeat N] "
+                 "[solver options...]\n";
+        return 1;
+    }
+    const char *corpus = argv[0];
+    std::string baselineFile;
+    double threshold     = 10.0;
+    double timeThreshold = 0; // times vary from run to run, only gated on request
+    int repeat           = 3;
+
+    // What we don't know goes to the solver
+    std::vector<char *> rest = { argv[0] };
+    for (int i = 1; i < argc; i += 1) {
+        if (i + 1 < argc && !strcmp(argv[i], "--baseline")) {
+            baselineFile = argv[++i];
+        } else if (i + 1 < argc && !strcmp(argv[i], "--threshold")) {
+            if (!real_option(argv[i], argv[i + 1], threshold)) {
+                return 1;
+            }
+            i += 1;
+        } else if (i + 1 < argc && !strcmp(argv[i], "--time-threshold")) {
+            if (!real_option(argv[i], argv[i + 1], timeThreshold)) {
+                return 1;
+            }
+            i += 1;
+        } else if (i + 1 < argc && !strcmp(argv[i], "--repeat")) {
+            if (!count_option(argv[i], argv[i + 1], repeat, 1, INT_MAX)) {
+                return 1;
+            }
+            i += 1;
+        } else {
+            rest.push_back(argv[i]);
+        }
+    }
+    SolverOptions opt;
+    if (!parse_options(rest.size(), rest.data(), opt)) {
+        return 1;
+    }
+
+    std::vector<Puzzle> puzzles;
+    if (!read_corpus(corpus, puzzles)) {
+        return 1;
+    }
+
+    std::unordered_map<std::string, std::string> baseline;
+    if (!baselineFile.empty()) {
+        std::ifstream in(baselineFile);
+        if (!in) {
+            error << "Can't open baseline \"" << baselineFile << "\"\n";
+            return 1;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            baseline[json_string(line, "name")] = line;
+        }
+    }
+
+    BenchResult total = { "total", "", 0, true, 0, 0, "" };
+    int regressions   = 0;
+    fprintf(stderr, "%-24s %6s %12s %10s %12s  %s\n", "puzzle", "length", "nodes", "ms", "nodes/s", "vs baseline");
+    for (const Puzzle &pz : puzzles) {
+        // Nodes don't change between runs, time does: keep the fastest,
+        // and the counters of that same run
+        BenchResult r = { pz.name, pz.fen, 0, false, 0, 0, "" };
+        PerfCounters::Values fastest {};
+        for (int i = 0; i < repeat; i += 1) {
+            Position pos(pz.fen);
+            perf_start();
+            double start     = now_ms();
+            SolveResult sr   = solve(pos, opt);
+            double ms        = now_ms() - start;
+            std::string perf = perf_stop(sr.nodes);
+            r.length         = sr.found ? sr.path.size() : -1;
+            r.optimal        = sr.optimal;
+            r.nodes          = sr.nodes;
+            if (i == 0 || ms < r.ms) {
+                r.ms    = ms;
+                r.perf  = perf;
+                fastest = perf_snapshot();
+            }
+        }
+        perf_restore(fastest);
+        print_json(r);
+        total.length += std::max(r.length, 0);
+        total.optimal = total.optimal && r.optimal;
+        total.nodes += r.nodes;
+        total.ms += r.ms;
+
+        std::string verdict;
+        auto it = baseline.find(pz.name);
+        if (it != baseline.end()) {
+            double baseLength = json_number(it->second, "length");
+            double baseNodes  = json_number(it->second, "nodes");
+            double baseMs     = json_number(it->second, "ms");
+            char buf[128];
+            snprintf(buf, sizeof(buf), "nodes %+.1f%% time %+.1f%%",
+                     baseNodes > 0 ? 100 * (r.nodes / baseNodes - 1) : 0.0,
+                     baseMs > 0 ? 100 * (r.ms / baseMs - 1) : 0.0);
+            verdict = buf;
+            if (baseLength != r.length) {
+                verdict += "  WRONG LENGTH";
+                regressions += 1;
+            } else if (r.nodes > baseNodes * (1 + threshold / 100)) {
+                verdict += "  REGRESSION";
+                regressions += 1;
+            } else if (timeThreshold > 0 && r.ms > baseMs * (1 + timeThreshold / 100) &&
+                       r.ms - baseMs > MIN_MS_REGRESSION) {
+                verdict += "  SLOWER";
+                regressions += 1;
+            }
+        }
+        fprintf(stderr, "%-24s %6d %12llu %10.3f %12.0f  %s\n", r.name.c_str(), r.length,
+                (unsigned long long)r.nodes, r.ms, r.ms > 0 ? r.nodes / (r.ms / 1e3) : 0.0, verdict.c_str());
+        perf_summary(r.nodes);
+    }
+
+    print_json(total);
+    fprintf(stderr, "%-24s %6d %12llu %10.3f %12.0f\n", "total", total.length,
+            (unsigned long long)total.nodes, total.ms, total.ms > 0 ? total.nodes / (total.ms / 1e3) : 0.0);
+    if (regressions) {
+        fprintf(stderr, "%d puzzle(s) regressed\n", regressions);
+        return 2;
+    }
+    return 0;
+}
+
+// -~ Perft ~-
+
+struct PerftEntry {
+    Key key;
+    uint64_t depth : 8;
+    uint64_t count : 56;
+};
+
+struct PerftTable {
+    std::unique_ptr<PerftEntry[]> entries;
+    size_t mask = 0;
+
+    PerftTable(size_t megabytes)
+    {
+        size_t n = 1;
+        while (megabytes && n * 2 * sizeof(PerftEntry) <= (megabytes << 20)) {
+            n <<= 1;
+        }
+        if (megabytes) {
+            entries.reset(new PerftEntry[n]());
+            mask = n - 1;
+        }
+    }
+
+    PerftEntry *slot(Key key, int depth) const
+    {
+        return entries ? &entries[(key ^ (depth * 0x9E3779B97F4A7C15ULL)) & mask] : nullptr;
+    }
+};
+
+// Leaves of the move tree, _depth_ plies down. HW1 rules: black moves on
+// and on, flips are not moves.
+static uint64_t perft(const Position &pos, int depth, PerftTable &tt)
+{
+    MoveList<Moving> moves(pos);
+    if (depth == 1) {
+        return moves.size(); // every generated move is legal
+    }
+
+    PerftEntry *e = depth > 2 ? tt.slot(pos.key(), depth) : nullptr;
+    if (e && e->key == pos.key() && e->depth == uint64_t(depth)) {
+        return e->count;
+    }
+
+    uint64_t count = 0;
+    for (Move mv : moves) {
+        Position next(pos);
+        if (next.do_move(mv)) {
+            count += perft(next, depth - 1, tt);
+        }
+    }
+    if (e) {
+        *e = { pos.key(), uint64_t(depth), count };
+    }
+    return count;
+}
+
+static int bench_perft(int argc, char *argv[])
+{
+    if (argc < 2) {
+        error << "Usage: wakabench perft CORPUS DEPTH [--hash MB] [--baseline FILE]\n";
+        return 1;
+    }
+    const char *corpus = argv[0];
+    int depth          = 0;
+    size_t hashMb      = 0;
+    std::string baselineFile;
+    if (!count_option("DEPTH", argv[1], depth, 1, MAX_PLY)) {
+        return 1;
+    }
+    for (int i = 2; i + 1 < argc; i += 1) {
+        if (!strcmp(argv[i], "--hash")) {
+            if (!count_option(argv[i], argv[i + 1], hashMb, 0, MAX_HASH_MB)) {
+                return 1;
+            }
+            i += 1;
+        } else if (!strcmp(argv[i], "--baseline")) {
+            baselineFile = argv[++i];
+        }
+    }
+
+    std::vector<Puzzle> puzzles;
+    if (!read_corpus(corpus, puzzles)) {
+        return 1;
+    }
+    std::unordered_map<std::string, double> expected;
+    if (!baselineFile.empty()) {
+        std::ifstream in(baselineFile);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (json_number(line, "depth") == depth) {
+                expected[json_string(line, "name")] = json_number(line, "nodes");
+            }
+        }
+    }
+
+    // Counts are exact, so any difference is a move generation bug
+    int wrong     = 0;
+    uint64_t sum  = 0;
+    double sumMs  = 0;
+    for (const Puzzle &pz : puzzles) {
+        PerftTable tt(hashMb);
+        Position pos(pz.fen);
+        perf_start();
+        double start     = now_ms();
+        uint64_t nodes   = perft(pos, depth, tt);
+        double ms        = now_ms() - start;
+        std::string perf = perf_stop(nodes);
+        sum += nodes;
+        sumMs += ms;
+        printf("{\"name\":\"%s\",\"depth\":%d,\"nodes\":%llu,\"ms\":%.3f,\"nps\":%.0f%s%s}\n",
+               pz.name.c_str(), depth, (unsigned long long)nodes, ms, ms > 0 ? nodes / (ms / 1e3) : 0.0,
+               perf.empty() ? "" : ",\"perf\":", perf.c_str());
+
+        auto it = expected.find(pz.name);
+        if (it != expected.end() && it->second != nodes) {
+            fprintf(stderr, "%s: perft(%d) = %llu, expected %.0f\n", pz.name.c_str(), depth,
+                    (unsigned long long)nodes, it->second);
+            wrong += 1;
+        }
+    }
+    fprintf(stderr, "perft(%d): %llu leaves in %.3f ms, %.0f leaves/s\n", depth, (unsigned long long)sum,
+            sumMs, sumMs > 0 ? sum / (sumMs / 1e3) : 0.0);
+    return wrong ? 2 : 0;
+}
+
+// -~ Game search ~-
+
+static std::string move_name(Move mv)
+{
+    std::ostringstream ss;
+    ss << mv.from();
+    if (mv.type() == Flipping) {
+        ss << "?";
+    } else {
+        ss << "-" << mv.to();
+    }
+    return ss.str();
+}
+
+// Full-game alpha-beta from every position, for its speed more than its moves
+static int bench_search(int argc, char *argv[])
+{
+    if (argc < 1) {
+        error << "Usage: wakabench search CORPUS [--depth N] [--movetime MS] [--hash MB] [--min-nps N] [--no-star] "
+                 "[--check-star] [--pimc K] [--threads N]\n";
+        return 1;
+    }
+    const char *corpus = argv[0];
+    SearchOptions opt;
+    opt.depth     = 6;
+    double minNps = 0;
+    bool pimc     = false;
+    bool check    = false; // every score again without Star1/Star2, must agree
+    for (int i = 1; i < argc; i += 1) {
+        if (!strcmp(argv[i], "--no-star")) {
+            opt.star = false;
+        } else if (!strcmp(argv[i], "--check-star")) {
+            check = true;
+        } else if (i + 1 >= argc) {
+            break;
+        } else {
+            const char *name  = argv[i];
+            const char *value = argv[i + 1];
+            bool ok           = true;
+            if (!strcmp(name, "--depth")) {
+                ok = count_option(name, value, opt.depth, 1, MAX_PLY - 1);
+            } else if (!strcmp(name, "--movetime")) {
+                ok = count_option(name, value, opt.moveTime, 0, UINT64_MAX);
+            } else if (!strcmp(name, "--hash")) {
+                ok = count_option(name, value, opt.hashMB, 1, MAX_HASH_MB);
+            } else if (!strcmp(name, "--min-nps")) {
+                ok = real_option(name, value, minNps);
+            } else if (!strcmp(name, "--pimc")) {
+                pimc = true;
+                ok   = count_option(name, value, opt.samples, 1, INT_MAX);
+            } else if (!strcmp(name, "--threads")) {
+                ok = count_option(name, value, opt.threads);
+            } else {
+                continue;
+            }
+            if (!ok) {
+                return 1;
+            }
+            i += 1;
+        }
+    }
+
+    std::vector<Puzzle> puzzles;
+    if (!read_corpus(corpus, puzzles)) {
+        return 1;
+    }
+
+    uint64_t sum     = 0;
+    uint64_t chances = 0;
+    uint64_t cuts    = 0;
+    double sumMs     = 0;
+    int mismatches   = 0;
+    for (const Puzzle &pz : puzzles) {
+        Position pos(pz.fen);
+        perf_start();
+        double start     = now_ms();
+        SearchResult sr  = pimc ? pimc_search(pos, opt) : search(pos, opt);
+        double ms        = now_ms() - start;
+        std::string perf = perf_stop(sr.nodes);
+        sum += sr.nodes;
+        sumMs += ms;
+        chances += sr.chances.nodes;
+        cuts += sr.chances.star1Cuts + sr.chances.star2Cuts;
+
+        std::string pv;
+        for (Move mv : sr.pv) {
+            pv += (pv.empty() ? "" : " ") + move_name(mv);
+        }
+        printf("{\"name\":\"%s\",\"fen\":\"%s\",\"depth\":%d,\"score\":%d,\"pv\":\"%s\",\"nodes\":%llu,"
+               "\"chance\":%llu,\"star1\":%llu,\"star2\":%llu,\"samples\":%d,\"ms\":%.3f,\"nps\":%.0f%s%s}\n",
+               pz.name.c_str(), pz.fen.c_str(), sr.depth, sr.score, pv.c_str(), (unsigned long long)sr.nodes,
+               (unsigned long long)sr.chances.nodes, (unsigned long long)sr.chances.star1Cuts,
+               (unsigned long long)sr.chances.star2Cuts, sr.samples, ms, ms > 0 ? sr.nodes / (ms / 1e3) : 0.0,
+               perf.empty() ? "" : ",\"perf\":", perf.c_str());
+        fprintf(stderr, "%-24s depth %2d score %6d %10llu nodes %9.3f ms  %s\n", pz.name.c_str(), sr.depth,
+                sr.score, (unsigned long long)sr.nodes, ms, pv.c_str());
+        perf_summary(sr.nodes);
+
+        if (check && opt.star) {
+            SearchOptions plain = opt;
+            plain.star          = false;
+            SearchResult ref    = pimc ? pimc_search(pos, plain) : search(pos, plain);
+            if (ref.score != sr.score) {
+                fprintf(stderr, "MISMATCH: %s scores %d with Star1/Star2, %d without\n", pz.name.c_str(), sr.score,
+                        ref.score);
+                mismatches += 1;
+            }
+        }
+    }
+
+    double nps = sumMs > 0 ? sum / (sumMs / 1e3) : 0.0;
+    fprintf(stderr, "search: %llu nodes in %.3f ms, %.0f nodes/s; %llu chance nodes, %.1f%% cut short\n",
+            (unsigned long long)sum, sumMs, nps, (unsigned long long)chances, chances ? 100.0 * cuts / chances : 0.0);
+    if (nps < minNps) {
+        fprintf(stderr, "REGRESSION: below %.0f nodes/s\n", minNps);
+        return 2;
+    }
+    return mismatches ? 2 : 0;
+}
+
+// MCTS on every position, and on for a few moves to see how much of the tree
+// carries over
+static int bench_mcts(int argc, char *argv[])
+{
+    if (argc < 1) {
+        error << "Usage: wakabench mcts CORPUS [--threads N] [--playouts N] [--movetime MS] [--mcts-mem MB] "
+                 "[--moves N]\n";
+        return 1;
+    }
+    const char *corpus = argv[0];
+    constexpr uint64_t MAX_ARENA_MB = 65536; // a typo shouldn't ask for terabytes
+    MctsOptions opt;
+    opt.playouts = 20000;
+    int moves    = 3;
+    for (int i = 1; i + 1 < argc; i += 1) {
+        bool ok = true;
+        if (!strcmp(argv[i], "--threads")) {
+            ok = count_option(argv[i], argv[i + 1], opt.threads);
+        } else if (!strcmp(argv[i], "--playouts")) {
+            ok = count_option(argv[i], argv[i + 1], opt.playouts, 0, UINT64_MAX);
+        } else if (!strcmp(argv[i], "--movetime")) {
+            ok = count_option(argv[i], argv[i + 1], opt.moveTime, 0, UINT64_MAX);
+        } else if (!strcmp(argv[i], "--mcts-mem")) {
+            ok = count_option(argv[i], argv[i + 1], opt.memoryMB, 1, MAX_ARENA_MB);
+        } else if (!strcmp(argv[i], "--moves")) {
+            ok = count_option(argv[i], argv[i + 1], moves, 1, INT_MAX);
+        } else {
+            continue;
+        }
+        if (!ok) {
+            return 1;
+        }
+        i += 1;
+    }
+
+    std::vector<Puzzle> puzzles;
+    if (!read_corpus(corpus, puzzles)) {
+        return 1;
+    }
+
+    uint64_t sum    = 0;
+    uint64_t reused = 0;
+    double sumMs    = 0;
+    for (const Puzzle &pz : puzzles) {
+        MctsTree tree(opt);
+        Position pos(pz.fen);
+        pos.set_rules(FullGame);
+        Key keys[KEY_HISTORY_SIZE]; // for threefold repetitions
+        pos.attach_history(keys);
+        std::string line;
+        for (int ply = 0; ply < moves; ply += 1) {
+            // winner() says NO_COLOR for a draw too
+            WinCon wc;
+            if (pos.winner(&wc) != NO_COLOR || pos.drawn(&wc)) {
+                line += " (" + wc.to_string() + ")";
+                break;
+            }
+            perf_start();
+            double start     = now_ms();
+            MctsResult mr    = tree.search(pos);
+            double ms        = now_ms() - start;
+            std::string perf = perf_stop(mr.playouts);
+            sum += mr.playouts;
+            sumMs += ms;
+            reused += mr.visits - mr.playouts;
+            printf("{\"name\":\"%s\",\"fen\":\"%s\",\"ply\":%d,\"best\":\"%s\",\"value\":%.3f,\"playouts\":%llu,"
+                   "\"reused\":%llu,\"nodes\":%llu,\"ms\":%.3f,\"pps\":%.0f%s%s}\n",
+                   pz.name.c_str(), pz.fen.c_str(), ply, move_name(mr.best).c_str(), mr.value,
+                   (unsigned long long)mr.playouts, (unsigned long long)(mr.visits - mr.playouts),
+                   (unsigned long long)mr.nodes, ms, ms > 0 ? mr.playouts / (ms / 1e3) : 0.0,
+                   perf.empty() ? "" : ",\"perf\":", perf.c_str());
+            perf_summary(mr.playouts);
+            if (mr.best == Move(0)) {
+                break;
+            }
+
+            // Play it, flips turning up whatever the bag gives
+            Position next(pos);
+            next.do_move(mr.best);
+            Piece revealed = next.peek_piece_at(mr.best.to());
+            tree.advance(mr.best, revealed);
+            pos = next;
+            line += (line.empty() ? "" : " ") + move_name(mr.best);
+            if (mr.best.type() == Flipping) {
+                char c = "KAERNCPD"[revealed.type];
+                line += "=" + std::string(1, revealed.side == Red ? char(tolower(c)) : c);
+            }
+        }
+        fprintf(stderr, "%-24s %s\n", pz.name.c_str(), line.c_str());
+    }
+
+    fprintf(stderr, "mcts: %llu playouts in %.3f ms, %.0f playouts/s; %llu visits kept across moves\n",
+            (unsigned long long)sum, sumMs, sumMs > 0 ? sum / (sumMs / 1e3) : 0.0, (unsigned long long)reused);
+    return 0;
+}
+
+// -~ Microbenchmarks ~-
+
+// Keeps the compiler from throwing away what we measure
+static volatile uint64_t sink;
+
+// Runs _op_ in batches and reports nanoseconds per call. The first tenth
+// of the batches only warms up caches and branch predictors.
+template<typename Op>
+static void measure(const char *name, int batches, int batchSize, Op op)
+{
+    std::vector<double> ns;
+    uint64_t acc = 0;
+    for (int b = -batches / 10; b < batches; b += 1) {
+        if (b == 0) {
+            perf_start(); // warm from here on
+        }
+        double start = now_ms();
+        for (int i = 0; i < batchSize; i += 1) {
+            acc += op(i);
+        }
+        if (b >= 0) {
+            ns.push_back((now_ms() - start) * 1e6 / batchSize);
+        }
+    }
+    uint64_t calls   = (uint64_t)batches * batchSize;
+    std::string perf = perf_stop(calls);
+    sink             = acc;
+
+    std::sort(ns.begin(), ns.end());
+    auto pct = [&](double p) { return ns[std::min<size_t>(ns.size() - 1, p * ns.size())]; };
+    printf("{\"bench\":\"%s\",\"batches\":%d,\"batch\":%d,\"ns_min\":%.2f,\"ns_p50\":%.2f,"
+           "\"ns_p90\":%.2f,\"ns_p99\":%.2f%s%s}\n",
+           name, batches, batchSize, ns.front(), pct(0.5), pct(0.9), pct(0.99),
+           perf.empty() ? "" : ",\"perf\":", perf.c_str());
+    fprintf(stderr, "%-20s %10.2f %10.2f %10.2f %10.2f\n", name, ns.front(), pct(0.5), pct(0.9), pct(0.99));
+    perf_summary(calls);
+}
+
+// Timing is steadier without migrations between cores
+static void pin_to_cpu(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        error << "Warning: can't pin to CPU " << cpu << ", timings may be noisy\n";
+    }
+}
+
+static int bench_micro(int argc, char *argv[])
+{
+    if (argc < 1) {
+        error << "Usage: wakabench micro CORPUS [--cpu N] [--batches N]\n";
+        return 1;
+    }
+    const char *corpus = argv[0];
+    int cpu            = sched_getcpu();
+    int batches        = 1000;
+    for (int i = 1; i + 1 < argc; i += 1) {
+        if (!strcmp(argv[i], "--cpu")) {
+            cpu = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--batches")) {
+            batches = std::max(10, atoi(argv[++i]));
+        }
+    }
+    pin_to_cpu(cpu);
+
+    std::vector<Puzzle> puzzles;
+    if (!read_corpus(corpus, puzzles) || puzzles.empty()) {
+        return 1;
+    }
+
+    // Everything random is made up front, so it isn't measured
+    constexpr int N = 4096;
+    pcg32 r(0xBE4C4ULL);
+    std::vector<Square> squares(N);
+    std::vector<Board> occupied(N);
+    for (int i = 0; i < N; i += 1) {
+        squares[i]  = Square(r(SQUARE_NB));
+        occupied[i] = r() | squares[i];
+    }
+
+    std::vector<Position> positions;
+    std::vector<std::pair<size_t, Move>> moves; // position index, move
+    std::vector<std::string> fens;
+    for (const Puzzle &pz : puzzles) {
+        positions.emplace_back(pz.fen);
+        fens.push_back(pz.fen);
+        for (Move mv : MoveList<Moving>(positions.back())) {
+            moves.push_back({ positions.size() - 1, mv });
+        }
+    }
+    size_t P = positions.size();
+    size_t M = moves.size();
+
+    fprintf(stderr, "%-20s %10s %10s %10s %10s\n", "ns/call", "min", "p50", "p90", "p99");
+    measure("attacks_chariot", batches, 1024, [&](int i) {
+        return attacks_bb<Chariot>(squares[i % N], occupied[i % N]);
+    });
+    measure("attacks_cannon", batches, 1024, [&](int i) {
+        return attacks_bb<Cannon>(squares[i % N], occupied[i % N]);
+    });
+    measure("generate_black", batches, 64, [&](int i) {
+        return MoveList<All, Black>(positions[i % P]).size();
+    });
+    measure("generate_red", batches, 64, [&](int i) {
+        return MoveList<All, Red>(positions[i % P]).size();
+    });
+    measure("do_move", batches, 256, [&](int i) {
+        Position next(positions[moves[i % M].first]);
+        return next.do_move(moves[i % M].second) + next.key();
+    });
+    measure("winner", batches, 64, [&](int i) {
+        return (uint64_t)positions[i % P].winner();
+    });
+    measure("toFEN", batches, 64, [&](int i) {
+        return positions[i % P].toFEN().size();
+    });
+    char buf[FEN_BUFFER_SIZE];
+    measure("toFEN_buffer", batches, 256, [&](int i) {
+        return positions[i % P].toFEN(buf);
+    });
+    measure("Position(fen)", batches, 64, [&](int i) {
+        return Position(fens[i % P]).key();
+    });
+    Position scratch;
+    measure("readFEN", batches, 256, [&](int i) {
+        scratch.clear();
+        scratch.readFEN(fens[i % P]);
+        return scratch.key();
+    });
+
+    // Throughput over the whole corpus, as batch tools see it
+    double start = now_ms();
+    size_t bytes = 0;
+    for (int round = 0; round < batches; round += 1) {
+        for (size_t i = 0; i < P; i += 1) {
+            scratch.clear();
+            scratch.readFEN(fens[i]);
+            bytes += scratch.toFEN(buf);
+        }
+    }
+    double ms = now_ms() - start;
+    printf("{\"bench\":\"fen_roundtrip\",\"fens\":%zu,\"ms\":%.3f,\"fens_per_s\":%.0f,\"mb_per_s\":%.2f}\n",
+           P * batches, ms, P * batches / (ms / 1e3), bytes / 1e6 / (ms / 1e3));
+    fprintf(stderr, "fen round trip: %.0f FENs/s\n", P * batches / (ms / 1e3));
+    return 0;
+}
+
+// FEN corpus -> record file, or back if IN is already a record file
+static int bench_convert(int argc, char *argv[])
+{
+    if (argc != 2) {
+        error << "Usage: wakabench convert IN OUT\n";
+        return 1;
+    }
+    const char *in  = argv[0];
+    const char *out = argv[1];
+
+    if (RecordReader::is_record_file(in)) {
+        RecordReader records;
+        FILE *f = fopen(out, "w");
+        if (!records.open(in) || !f) {
+            if (f) {
+                fclose(f);
+            }
+            error << "Can't convert \"" << in << "\" to \"" << out << "\"\n";
+            return 1;
+        }
+        char fen[FEN_BUFFER_SIZE + 32];
+        for (size_t i = 0; i < records.records(); i += 1) {
+            size_t n = record_to_fen(records[i], fen);
+            n += snprintf(fen + n, sizeof(fen) - n, " rec-%zu\n", i);
+            fwrite(fen, 1, n, f);
+        }
+        fclose(f);
+        error << records.records() << " records -> \"" << out << "\"\n";
+        return 0;
+    }
+
+    std::vector<Puzzle> puzzles;
+    RecordWriter writer;
+    if (!read_corpus(in, puzzles) || !writer.open(out)) {
+        return 1;
+    }
+    for (const Puzzle &p : puzzles) {
+        PositionRecord rec;
+        if (!fen_to_record(p.fen, rec)) {
+            error << "Bad FEN for " << p.name << "\n";
+            return 1;
+        }
+        writer.write(rec);
+    }
+    if (!writer.close()) {
+        error << "Can't write \"" << out << "\"\n";
+        return 1;
+    }
+    error << puzzles.size() << " puzzles -> \"" << out << "\"\n";
+    return 0;
+}
+
+// Many solutions at once, see validator.h
+static int bench_validate(int argc, char *argv[])
+{
+    if (argc < 1) {
+        error << "Usage: wakabench validate FILE [--threads N] [--positions RECORDS]\n";
+        return 1;
+    }
+    unsigned threads      = 0;
+    const char *positions = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--threads")) {
+            threads = atoi(argv[i + 1]);
+        } else if (!strcmp(argv[i], "--positions")) {
+            positions = argv[i + 1];
+        }
+    }
+    return batch_validate(argv[0], threads, positions);
+}
+
+int bench_main(int argc, char *argv[])
+{
+    // --perf and --seed go anywhere on the command line. Runs are the same
+    // every time, seed 0 if not given. --seed stays for the generator.
+    static PerfCounters perf;
+    uint64_t seed = 0;
+    int n         = 0;
+    for (int i = 0; i < argc; i += 1) {
+        if (!strcmp(argv[i], "--seed") && i + 1 < argc && !count_option(argv[i], argv[i + 1], seed, 0, UINT64_MAX)) {
+            return 1;
+        }
+        if (strcmp(argv[i], "--perf")) {
+            argv[n++] = argv[i];
+        } else if (!counters) {
+            if (perf.open()) {
+                counters = &perf;
+            } else {
+                error << "Warning: no hardware counters (see /proc/sys/kernel/perf_event_paranoid), going on without\n";
+            }
+        }
+    }
+    argc = n;
+    seed_rng(seed);
+
+    if (argc >= 2 && !strcmp(argv[1], "solve")) {
+        return bench_solve(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "perft")) {
+        return bench_perft(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "search")) {
+        return bench_search(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "mcts")) {
+        return bench_mcts(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "micro")) {
+        return bench_micro(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "generate")) {
+        return generate_main(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "convert")) {
+        return bench_convert(argc - 2, argv + 2);
+    }
+    if (argc >= 2 && !strcmp(argv[1], "validate")) {
+        return bench_validate(argc - 2, argv + 2);
+    }
+    error << "Usage: wakabench solve|perft|search|mcts|micro CORPUS [options...]\n"
+          << "       wakabench generate [options...]\n"
+          << "       wakabench convert IN OUT\n"
+          << "       wakabench validate FILE [--threads N] [--positions RECORDS]\n";
+    return 1;
+}
@@ -0,0 +1,56 @@
+// Wakasagi: benchmarks
+// ----------------------------------
+// `make bench` builds wakabench (-DWAKASAGI_BENCH=1) and runs it over the
+// puzzle corpus in bench/. Results are JSON lines on stdout, one per puzzle
+// and one for the total, with a readable table on stderr.
+//
+// Usage: wakabench solve CORPUS [--baseline FILE] [--threshold PCT]
+//                               [--time-threshold PCT] [--repeat N]
+//                               [solver options...]
+//        wakabench perft CORPUS DEPTH [--hash MB] [--baseline FILE]
+//        wakabench search CORPUS [--depth N] [--movetime MS] [--hash MB]
+//                                [--min-nps N] [--no-star] [--check-star]
+//                                [--pimc K] [--threads N]
+//        wakabench mcts CORPUS [--threads N] [--playouts N] [--movetime MS]
+//                              [--mcts-mem MB] [--moves N]
+//        wakabench micro CORPUS [--cpu N] [--batches N]
+//        wakabench generate [options...], see generator.h
+//        wakabench convert IN OUT
+//        wakabench validate FILE [--threads N] [--positions RECORDS]
+//
+//   solve    Solves every puzzle, see above. Fails on a solution of another
+//            length than the baseline's, or more than --threshold percent
+//            (10) more nodes. Times are only reported: they vary from run to
+//            run. --time-threshold fails on them too, when asked for.
+//   perft    Counts the move tree of every puzzle to DEPTH plies; counts in
+//            the baseline must match exactly
+//   search   Runs the full-game search (see search.h) on every position;
+//            fails if it searches fewer than --min-nps nodes a second.
+//            --pimc searches K deals of the hidden pieces instead.
+//            --check-star searches again without Star1/Star2 and fails if
+//            any score differs (bench/hidden.fen has face-down pieces)
+//   mcts     Runs MCTS (see mcts.h) on every position and plays on for
+//            --moves moves, or until the game is won or drawn, reporting
+//            playouts a second and how many root visits each move kept from
+//            the last search
+//   micro    Times attacks_bb, move generation, do_move, winner() and FENs,
+//            pinned to one CPU, with percentiles over batches of calls
+//   convert  FEN corpus to a record file (see record.h), or back
+//   validate Replays many solutions at once, see validator.h
+//
+// Any CORPUS may also be a record file.
+// --perf anywhere adds hardware counters (see perf.h) to every result,
+// per search node, perft leaf or microbenchmark call. --seed S anywhere
+// seeds every random choice (see seed_rng()), 0 if not given.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/*
+ * Runs the benchmark named on the command line.
+ * @returns Exit status: 0 if fine, 1 on bad usage, 2 if something regressed
+ *          against the baseline or a solution came out the wrong length.
+ */
+int bench_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,236 @@
+// Wakasagi: solution cache
+// ----------------------------------
+
+#include "cache.h"
+#include "lib/cdc.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr uint64_t CACHE_MAGIC   = 0x4843414741534157ULL; // "WASAGACH"
+constexpr uint32_t CACHE_VERSION = 1;
+constexpr size_t MAX_PROBES      = 16;
+constexpr int MAX_RETRIES        = 1024; // a writer died inside the slot?
+
+static_assert(sizeof(CacheHeader) == 64, "cache header must stay 64 bytes");
+static_assert(sizeof(CacheSlot) == 96, "cache slots must stay 96 bytes");
+
+// Holds an flock() for as long as it lives
+struct FileLock {
+    int fd;
+    FileLock(int fd, int op)
+      : fd(fd)
+    {
+        while (flock(fd, op) != 0 && errno == EINTR) {}
+    }
+    ~FileLock() { flock(fd, LOCK_UN); }
+};
+
+static void pack_moves(const std::vector<Move> &moves, Symmetry sym, uint8_t *out)
+{
+    memset(out, 0, CACHE_MAX_MOVES * 10 / 8);
+    for (size_t i = 0; i < moves.size(); i += 1) {
+        Move mv       = mirror(moves[i], sym);
+        unsigned bits = mv.from() | (mv.to() << 5);
+        size_t bit    = i * 10;
+        out[bit / 8] |= bits << (bit % 8);
+        out[bit / 8 + 1] |= bits >> (8 - bit % 8);
+    }
+}
+
+static void unpack_moves(const uint8_t *in, int length, Symmetry sym, std::vector<Move> &moves)
+{
+    moves.clear();
+    for (int i = 0; i < length; i += 1) {
+        size_t bit    = i * 10;
+        unsigned bits = (in[bit / 8] | (in[bit / 8 + 1] << 8)) >> (bit % 8);
+        Square from   = Square(bits & 0x1F);
+        Square to     = Square((bits >> 5) & 0x1F);
+        moves.push_back(mirror(Move(from, to), sym));
+    }
+}
+
+bool SolutionCache::open(const std::string &path, size_t slotCount)
+{
+    close();
+
+    writable = true;
+    fd       = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        writable = false;
+        fd       = ::open(path.c_str(), O_RDONLY);
+    }
+    if (fd < 0) {
+        error << "Warning: can't open solution cache \"" << path << "\"\n";
+        return false;
+    }
+
+    // Whoever gets here first lays out the file
+    CacheHeader h;
+    struct stat st;
+    {
+        FileLock lock(fd, writable ? LOCK_EX : LOCK_SH);
+        if (fstat(fd, &st) != 0) {
+            error << "Warning: can't open solution cache \"" << path << "\"\n";
+            close();
+            return false;
+        }
+        if (st.st_size == 0 && writable) {
+            size_t n = 1;
+            while (n < slotCount) {
+                n <<= 1;
+            }
+            memset(&h, 0, sizeof(h));
+            h.magic     = CACHE_MAGIC;
+            h.version   = CACHE_VERSION;
+            h.slotSize  = sizeof(CacheSlot);
+            h.slotCount = n;
+            if (ftruncate(fd, sizeof(CacheHeader) + n * sizeof(CacheSlot)) != 0 ||
+                pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+                error << "Warning: can't create solution cache \"" << path << "\"\n";
+                close();
+                return false;
+            }
+            st.st_size = sizeof(CacheHeader) + n * sizeof(CacheSlot);
+        } else if (pread(fd, &h, sizeof(h), 0) != sizeof(h)) {
+            h.magic = 0;
+        }
+    }
+
+    // A file cut short would fault as soon as its missing slots are touched
+    uint64_t size = st.st_size;
+    bool fits     = size >= sizeof(CacheHeader) && h.slotCount <= (size - sizeof(CacheHeader)) / sizeof(CacheSlot);
+    if (h.magic != CACHE_MAGIC || h.version != CACHE_VERSION || h.slotSize != sizeof(CacheSlot) ||
+        (h.slotCount & (h.slotCount - 1)) != 0 || !fits) {
+        error << "Warning: \"" << path << "\" is not a solution cache\n";
+        close();
+        return false;
+    }
+
+    mapSize    = sizeof(CacheHeader) + h.slotCount * sizeof(CacheSlot);
+    void *base = mmap(nullptr, mapSize, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        error << "Warning: can't map solution cache \"" << path << "\"\n";
+        close();
+        return false;
+    }
+    header = static_cast<CacheHeader *>(base);
+    slots  = reinterpret_cast<CacheSlot *>(header + 1);
+    return true;
+}
+
+void SolutionCache::close()
+{
+    if (header != nullptr) {
+        munmap(header, mapSize);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd      = -1;
+    header  = nullptr;
+    slots   = nullptr;
+    mapSize = 0;
+}
+
+CacheSlot *SolutionCache::slot_for(Key key, size_t probe) const
+{
+    return &slots[(key + probe) & (header->slotCount - 1)];
+}
+
+bool SolutionCache::probe(const Position &pos, std::vector<Move> &moves) const
+{
+    if (!is_open()) {
+        return false;
+    }
+
+    Symmetry sym;
+    Key key = canonical_key(pos, &sym);
+    key     = key ? key : 1; // 0 marks empty slots
+
+    for (size_t i = 0; i < MAX_PROBES; i += 1) {
+        CacheSlot *slot = slot_for(key, i);
+
+        // Seqlock read: retry if a writer was inside the slot meanwhile
+        Key found      = 0;
+        uint8_t length = 0;
+        uint8_t packed[sizeof(slot->moves)];
+        bool consistent = false;
+        for (int tries = 0; !consistent && tries < MAX_RETRIES; tries += 1) {
+            uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            if (seq & 1) {
+                continue;
+            }
+            found  = __atomic_load_n(&slot->key, __ATOMIC_RELAXED);
+            length = __atomic_load_n(&slot->length, __ATOMIC_RELAXED);
+            memcpy(packed, slot->moves, sizeof(packed));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            consistent = seq == __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+        }
+
+        if (!consistent) {
+            continue;
+        }
+        if (found == 0) {
+            return false;
+        }
+        if (found != key || length > CACHE_MAX_MOVES) {
+            continue;
+        }
+
+        unpack_moves(packed, length, sym, moves);
+
+        // Make sure it really is ours
+        Position replay(pos);
+        for (Move mv : moves) {
+            if (!replay.do_move(mv)) {
+                return false;
+            }
+        }
+        return replay.winner() == Black;
+    }
+    return false;
+}
+
+void SolutionCache::store(const Position &pos, const std::vector<Move> &moves)
+{
+    if (!is_open() || !writable || moves.size() > CACHE_MAX_MOVES) {
+        return;
+    }
+
+    Symmetry sym;
+    Key key = canonical_key(pos, &sym);
+    key     = key ? key : 1;
+
+    FileLock lock(fd, LOCK_EX);
+
+    // First empty or matching slot, otherwise evict the last one probed
+    CacheSlot *slot = nullptr;
+    for (size_t i = 0; i < MAX_PROBES; i += 1) {
+        slot = slot_for(key, i);
+        if (slot->key == 0) {
+            break;
+        }
+        if (slot->key == key) {
+            if (slot->length <= moves.size()) {
+                return; // already have one at least as short
+            }
+            break;
+        }
+    }
+
+    uint32_t odd = slot->seq | 1; // stays odd if a previous writer died midway
+    __atomic_store_n(&slot->seq, odd, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->length, uint8_t(moves.size()), __ATOMIC_RELAXED);
+    pack_moves(moves, sym, slot->moves);
+
+    __atomic_store_n(&slot->seq, odd + 1, __ATOMIC_RELEASE);
+}
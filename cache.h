@@ -0,0 +1,88 @@
+// Wakasagi: solution cache
+// ----------------------------------
+// Solutions that survive between runs, kept in a memory-mapped file.
+// Processes on the same host can share one file: lookups never block,
+// writers take turns with flock().
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "lib/chess.h"
+#include "lib/types.h"
+#include "symmetry.h"
+
+#include <string>
+#include <vector>
+
+// Longer solutions are not cached
+constexpr int CACHE_MAX_MOVES = 64;
+
+// -~ File layout ~-
+// A header followed by a power-of-2 number of slots, open addressing with
+// linear probing. Positions are keyed by canonical_key() and solutions are
+// stored in the canonical orientation.
+struct CacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slotSize;
+    uint64_t slotCount;
+    uint8_t unused[40];
+};
+
+struct CacheSlot {
+    uint32_t seq;    // odd while a writer is in the middle of this slot
+    uint8_t length;  // number of moves
+    uint8_t unused[3];
+    Key key;         // 0 if empty
+    uint8_t moves[CACHE_MAX_MOVES * 10 / 8]; // 10 bits per move: from, to
+};
+
+class SolutionCache {
+    private:
+    int fd = -1;
+    size_t mapSize = 0;
+    CacheHeader *header = nullptr;
+    CacheSlot *slots = nullptr;
+    bool writable = false;
+
+    CacheSlot *slot_for(Key key, size_t probe) const;
+
+    public:
+    SolutionCache() = default;
+    SolutionCache(const SolutionCache &) = delete;
+    SolutionCache &operator=(const SolutionCache &) = delete;
+    ~SolutionCache() { close(); }
+
+    /*
+     * Opens a cache file, creating it if it does not exist yet.
+     * Falls back to read-only if the file can't be written.
+     *
+     * @param   path    The file
+     * @param   slots   Number of slots if the file has to be created,
+     *                  rounded up to a power of 2
+     * @returns Whether the cache can be used
+     */
+    bool open(const std::string &path, size_t slots = 1 << 16);
+    void close();
+    bool is_open() const { return slots != nullptr; }
+
+    /*
+     * Looks up the solution of a position.
+     * @param   pos     The position
+     * @param   moves   Receives the solution, oriented like _pos_
+     * @returns Whether a solution was found
+     * @note    Solutions are replayed before they are returned,
+     *          so a hash collision can only cause a miss.
+     */
+    bool probe(const Position &pos, std::vector<Move> &moves) const;
+
+    /*
+     * Stores the solution of a position. Does nothing if the cache is
+     * read-only or the solution is longer than CACHE_MAX_MOVES.
+     * @param   pos     The position
+     * @param   moves   Its solution, oriented like _pos_
+     */
+    void store(const Position &pos, const std::vector<Move> &moves);
+};
+
+#endif
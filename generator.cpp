@@ -0,0 +1,281 @@
+// Wakasagi: puzzle generator
+// ----------------------------------
+
+#include "generator.h"
+#include "parallel.h"
+#include "record.h"
+#include "solver.h"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Range {
+    int min, max;
+
+    int pick(pcg32 &r) const { return min + r(max - min + 1); }
+    bool contains(int x) const { return min <= x && x <= max; }
+};
+
+enum DuckPlacement { DUCKS_ANYWHERE, DUCKS_EDGE, DUCKS_CENTER };
+
+struct GeneratorOptions {
+    int count          = 10;
+    uint64_t seed      = 0;
+    unsigned threads   = 0;
+    Range black        = { 1, 4 };
+    Range red          = { 2, 8 };
+    Range ducks        = { 0, 2 };
+    DuckPlacement at   = DUCKS_ANYWHERE;
+    std::string blackTypes = "KAERNCP";
+    std::string redTypes   = "kaerncp";
+    Range length       = { 1, 20 };
+    uint64_t maxNodes  = 2000000;
+    size_t attempts    = 0;
+    bool corpus        = false;
+    std::string binary; // record file to write instead of stdout
+};
+
+static bool parse_range(const char *s, Range &r)
+{
+    int n = sscanf(s, "%d-%d", &r.min, &r.max);
+    if (n == 1) {
+        r.max = r.min;
+    }
+    return n >= 1 && 0 <= r.min && r.min <= r.max;
+}
+
+static bool parse_generator_options(int argc, char *argv[], GeneratorOptions &opt)
+{
+    for (int i = 0; i < argc; i += 1) {
+        std::string arg = argv[i];
+        if (arg == "--corpus") {
+            opt.corpus = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            error << "Option \"" << arg << "\" needs a value\n";
+            return false;
+        }
+        const char *value = argv[++i];
+        bool ok           = true;
+        uint64_t n        = 0;
+        if (arg == "--count") {
+            ok        = parse_count(value, n) && n <= INT_MAX;
+            opt.count = n;
+        } else if (arg == "--seed") {
+            ok = parse_count(value, opt.seed);
+        } else if (arg == "--threads") {
+            ok          = parse_count(value, n) && n <= UINT_MAX;
+            opt.threads = n;
+        } else if (arg == "--black") {
+            ok = parse_range(value, opt.black);
+        } else if (arg == "--red") {
+            ok = parse_range(value, opt.red);
+        } else if (arg == "--ducks") {
+            ok = parse_range(value, opt.ducks);
+        } else if (arg == "--ducks-at") {
+            std::string v = value;
+            opt.at        = v == "edge" ? DUCKS_EDGE : v == "center" ? DUCKS_CENTER : DUCKS_ANYWHERE;
+            ok            = v == "edge" || v == "center" || v == "anywhere";
+        } else if (arg == "--black-types") {
+            opt.blackTypes = value;
+        } else if (arg == "--red-types") {
+            opt.redTypes = value;
+        } else if (arg == "--length") {
+            ok = parse_range(value, opt.length);
+        } else if (arg == "--max-nodes") {
+            ok = parse_count(value, opt.maxNodes);
+        } else if (arg == "--attempts") {
+            ok           = parse_count(value, n);
+            opt.attempts = n;
+        } else if (arg == "--binary") {
+            opt.binary = value;
+        } else {
+            error << "Unknown option \"" << arg << "\"\n";
+            return false;
+        }
+        if (!ok) {
+            error << "Bad value \"" << value << "\" for " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// The pieces Position::add_collection() puts in the bag for one side
+static std::vector<char> standard_bag(Color side, const std::string &allowed)
+{
+    static const char PIECES[] = "KAAEERRNNCCPPPPP";
+    std::vector<char> bag;
+    for (const char *c = PIECES; *c; c += 1) {
+        char p = side == Red ? *c - 'A' + 'a' : *c;
+        if (allowed.find(p) != std::string::npos) {
+            bag.push_back(p);
+        }
+    }
+    return bag;
+}
+
+static char draw(std::vector<char> &bag, pcg32 &r)
+{
+    size_t i = r(bag.size());
+    char p   = bag[i];
+    bag[i]   = bag.back();
+    bag.pop_back();
+    return p;
+}
+
+// Candidate number _index_ of seed _seed_: its own pcg32 stream, so it
+// doesn't matter which thread deals it
+static std::string deal(const GeneratorOptions &opt, size_t index)
+{
+    pcg32 r(opt.seed, index);
+    char board[SQUARE_NB];
+    memset(board, 0, sizeof(board));
+
+    std::vector<Square> edge, center, all;
+    for (Square sq = SQ_A1; sq < SQUARE_NB; sq += 1) {
+        bool onEdge = rank_of(sq) == RANK_1 || rank_of(sq) == RANK_4 || file_of(sq) == FILE_A || file_of(sq) == FILE_H;
+        (onEdge ? edge : center).push_back(sq);
+        all.push_back(sq);
+    }
+    std::vector<Square> &duckSquares = opt.at == DUCKS_EDGE ? edge : opt.at == DUCKS_CENTER ? center : all;
+
+    auto take = [&](std::vector<Square> &from) {
+        while (!from.empty()) {
+            size_t i  = r(from.size());
+            Square sq = from[i];
+            from[i]   = from.back();
+            from.pop_back();
+            if (!board[sq]) {
+                return sq;
+            }
+        }
+        return SQ_NONE;
+    };
+
+    for (int n = opt.ducks.pick(r); n > 0; n -= 1) {
+        Square sq = take(duckSquares);
+        if (sq != SQ_NONE) {
+            board[sq] = 'D';
+        }
+    }
+    std::vector<char> blackBag = standard_bag(Black, opt.blackTypes);
+    std::vector<char> redBag   = standard_bag(Red, opt.redTypes);
+    for (int n = opt.black.pick(r); n > 0 && !blackBag.empty(); n -= 1) {
+        Square sq = take(all);
+        if (sq != SQ_NONE) {
+            board[sq] = draw(blackBag, r);
+        }
+    }
+    for (int n = opt.red.pick(r); n > 0 && !redBag.empty(); n -= 1) {
+        Square sq = take(all);
+        if (sq != SQ_NONE) {
+            board[sq] = draw(redBag, r);
+        }
+    }
+
+    std::string fen;
+    for (int rk = RANK_1; rk <= RANK_4; rk += 1) {
+        int empty = 0;
+        for (File f = FILE_A; f <= FILE_H; f += 1) {
+            char c = board[make_square(f, Rank(rk))];
+            if (!c) {
+                empty += 1;
+                continue;
+            }
+            if (empty) {
+                fen += char('0' + empty);
+            }
+            empty = 0;
+            fen += c;
+        }
+        if (empty) {
+            fen += char('0' + empty);
+        }
+        fen += rk == RANK_4 ? " b" : "/";
+    }
+    return fen;
+}
+
+enum Verdict { ACCEPTED, UNSOLVABLE, TOO_HARD, OUT_OF_RANGE, VERDICT_NB };
+
+int generate_main(int argc, char *argv[])
+{
+    GeneratorOptions opt;
+    if (!parse_generator_options(argc, argv, opt)) {
+        return 1;
+    }
+    size_t attempts = opt.attempts ? opt.attempts : 1000 * (size_t)std::max(opt.count, 1);
+    RecordWriter records;
+    if (!opt.binary.empty() && !records.open(opt.binary)) {
+        return 1;
+    }
+
+    // Results come in any order and go out in candidate order
+    std::mutex mutex;
+    std::map<size_t, std::string> pending;
+    size_t nextOut = 0;
+    int printed    = 0;
+    uint64_t verdicts[VERDICT_NB] = {};
+    std::atomic<bool> done(opt.count <= 0);
+
+    parallel_for(attempts, thread_count(opt.threads), [&](size_t i, unsigned) {
+        if (done) {
+            return;
+        }
+        std::string fen = deal(opt, i);
+        Position pos(fen);
+        SolverOptions so;
+        so.nodeLimit   = opt.maxNodes;
+        SolveResult sr = solve(pos, so);
+
+        Verdict v = sr.lowerBound >= INF                 ? UNSOLVABLE
+                  : !sr.optimal                          ? TOO_HARD
+                  : !opt.length.contains(sr.path.size()) ? OUT_OF_RANGE
+                                                         : ACCEPTED;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        verdicts[v] += 1;
+        if (v == ACCEPTED) {
+            char name[64];
+            snprintf(name, sizeof(name), "  gen-%llu-%zu-%zu", (unsigned long long)opt.seed, i, sr.path.size());
+            pending[i] = opt.corpus && opt.binary.empty() ? fen + name : fen;
+        } else {
+            pending[i] = "";
+        }
+        while (!pending.empty() && pending.begin()->first == nextOut) {
+            if (!pending.begin()->second.empty() && printed < opt.count) {
+                PositionRecord rec;
+                if (opt.binary.empty()) {
+                    printf("%s\n", pending.begin()->second.c_str());
+                    fflush(stdout);
+                } else if (fen_to_record(pending.begin()->second, rec)) {
+                    records.write(rec);
+                }
+                printed += 1;
+            }
+            pending.erase(pending.begin());
+            nextOut += 1;
+        }
+        if (printed >= opt.count) {
+            done = true;
+        }
+    });
+
+    fprintf(stderr, "%d puzzles; %llu tried: %llu kept, %llu unsolvable, %llu over %llu nodes, %llu out of range\n",
+            printed, (unsigned long long)(verdicts[0] + verdicts[1] + verdicts[2] + verdicts[3]),
+            (unsigned long long)verdicts[ACCEPTED], (unsigned long long)verdicts[UNSOLVABLE],
+            (unsigned long long)verdicts[TOO_HARD], (unsigned long long)opt.maxNodes,
+            (unsigned long long)verdicts[OUT_OF_RANGE]);
+    if (!records.close()) {
+        error << "Can't write \"" << opt.binary << "\"\n";
+        return 1;
+    }
+    return printed < opt.count ? 2 : 0;
+}
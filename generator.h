@@ -0,0 +1,33 @@
+// Wakasagi: puzzle generator
+// ----------------------------------
+// Random HW1 puzzles for testing and the benchmark corpus. Pieces are dealt
+// from the standard bag (as Position::setup() flips them), the puzzle is
+// solved, and it is kept only if its optimal length is in range.
+//
+// Usage: wakabench generate [options]
+//   --count N          puzzles to print (default 10)
+//   --seed S           same seed, same puzzles, whatever the thread count
+//   --threads N        default: all cores
+//   --black MIN[-MAX]  black pieces, ducks not included (default 1-4)
+//   --red MIN[-MAX]    red pieces (default 2-8)
+//   --ducks MIN[-MAX]  (default 0-2)
+//   --ducks-at WHERE   anywhere, edge or center
+//   --black-types S    only these black pieces, e.g. RNP (default all)
+//   --red-types S      only these red pieces, e.g. aenp (default all)
+//   --length MIN[-MAX] optimal solution length (default 1-20)
+//   --max-nodes N      give up on a candidate after this many nodes
+//   --attempts N       candidates to try in all (default 1000 per puzzle)
+//   --corpus           print names too, in the bench/puzzles.fen format
+//   --binary FILE      write a record file (see record.h) instead
+//
+// Puzzles go to stdout (or FILE) as they are found, in seed order.
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+/*
+ * @returns Exit status
+ */
+int generate_main(int argc, char *argv[]);
+
+#endif
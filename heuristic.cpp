@@ -0,0 +1,328 @@
+// Wakasagi: search heuristic
+// ----------------------------------
+
+#include "heuristic.h"
+#include "solver.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Every square one step away from any square of _b_
+static Board step_attacks(Board b)
+{
+    return ((b << 1) & ~FileABB) | ((b >> 1) & ~FileHBB) | (b << 8) | (b >> 8);
+}
+
+void HeuristicState::build(DistanceMap &m) const { build_map(m, obstacles); }
+
+// Breadth-first, one whole layer of squares at a time
+void HeuristicState::build_map(DistanceMap &m, Board obstacles)
+{
+    m.reached          = square_bb(m.source);
+    m.frontier         = 0;
+    m.dist[m.source]   = 0;
+    if (m.type == Cannon) {
+        return; // see score()
+    }
+
+    Board layer = m.reached;
+    for (int d = 1; layer; d += 1) {
+        Board next = 0;
+        if (m.type == Chariot) {
+            for (Square sq : BoardView(layer)) {
+                next |= attacks_bb<Chariot>(sq, obstacles);
+            }
+        } else {
+            next = step_attacks(layer);
+        }
+        m.frontier |= next & obstacles;
+        next &= ~obstacles & ~m.reached;
+        for (Square sq : BoardView(next)) {
+            m.dist[sq] = d;
+        }
+        m.reached |= next;
+        layer = next;
+    }
+}
+
+void HeuristicState::score(DistanceMap &m, const Position &pos) const
+{
+    m.best = INF;
+    for (Square rp : BoardView(reds)) {
+        if (!(m.type > pos.peek_piece_at(rp).type)) {
+            continue;
+        }
+        if (m.type == Cannon) {
+            // jumps from anywhere on the same line, needs a screen though
+            bool aligned = rank_of(m.source) == rank_of(rp) || file_of(m.source) == file_of(rp);
+            m.best       = std::min(m.best, aligned ? 1 : 2);
+            continue;
+        }
+        // squares the capture can be made from
+        Board from = (m.type == Chariot ? attacks_bb<Chariot>(rp, obstacles) : PseudoAttacks[rp]) & m.reached;
+        for (Square sq : BoardView(from)) {
+            m.best = std::min(m.best, m.dist[sq] + 1);
+        }
+    }
+}
+
+HeuristicState::HeuristicState(const Position &pos)
+  : mapCount(0)
+  , obstacles(pos.pieces() & ~pos.pieces(Black))
+  , reds(pos.pieces(Red))
+  , stale(0)
+  , unscored(0)
+{
+    for (Square sq : BoardView(pos.pieces(Black))) {
+        PieceType pt = pos.peek_piece_at(sq).type;
+        if (pt == Duck) {
+            continue;
+        }
+        DistanceMap &m = maps[mapCount++];
+        m.source       = sq;
+        m.type         = pt;
+        build(m);
+        score(m, pos);
+    }
+}
+
+void HeuristicState::do_move(Move mv, bool capture)
+{
+    Square from = mv.from();
+    Square to   = mv.to();
+    if (capture) {
+        obstacles ^= to;
+        reds ^= to;
+    }
+
+    for (int i = 0; i < mapCount; i += 1) {
+        DistanceMap &m = maps[i];
+        if (m.source == from) {
+            m.source = to;
+            stale |= 1 << i;
+        } else if (!capture) {
+            continue; // nobody else's map or targets changed
+        } else if (m.frontier & to) {
+            stale |= 1 << i;
+        }
+        unscored |= 1 << i;
+    }
+}
+
+int HeuristicState::quiet_moves(const Position &pos)
+{
+    if (reds == 0) {
+        return 0;
+    }
+
+    for (int i : BoardView(stale)) {
+        build(maps[i]);
+    }
+    for (int i : BoardView(unscored)) {
+        score(maps[i], pos);
+    }
+    stale = unscored = 0;
+
+    int best = INF;
+    for (int i = 0; i < mapCount; i += 1) {
+        best = std::min(best, maps[i].best);
+    }
+    // the last step is the capture itself
+    return best == INF ? INF : best - 1;
+}
+
+// Moves a _pt_ needs to capture one of _reds_, from every square. Moves are
+// reversible on empty squares, so this is a search outward from the squares
+// the captures can be made from.
+static void goal_distances(PieceType pt, Board obstacles, Board reds, const Position &pos, uint8_t dist[SQUARE_NB])
+{
+    memset(dist, 255, SQUARE_NB);
+    Board layer = 0;
+    for (Square rp : BoardView(reds)) {
+        if (pt > pos.peek_piece_at(rp).type) {
+            layer |= pt == Chariot ? attacks_bb<Chariot>(rp, obstacles) : PseudoAttacks[rp];
+        }
+    }
+    layer &= ~obstacles;
+
+    Board reached = layer;
+    for (int d = 1; layer; d += 1) {
+        for (Square sq : BoardView(layer)) {
+            dist[sq] = d;
+        }
+        Board next = 0;
+        if (pt == Chariot) {
+            for (Square sq : BoardView(layer)) {
+                next |= attacks_bb<Chariot>(sq, obstacles);
+            }
+        } else {
+            next = step_attacks(layer);
+        }
+        layer = next & ~obstacles & ~reached;
+        reached |= layer;
+    }
+}
+
+void HeuristicState::relevance(const Position &pos, Relevance &r)
+{
+    quiet_moves(pos); // brings the maps up to date
+
+    uint8_t goal[PIECE_TYPE_NB][SQUARE_NB];
+    uint32_t known = 0;
+    Board blacks   = pos.pieces(Black);
+
+    r.blockers = 0;
+    for (int i = 0; i < mapCount; i += 1) {
+        const DistanceMap &m = maps[i];
+        r.to[m.source]       = 0;
+        if (m.best == INF) {
+            continue; // nothing left for it to capture
+        }
+        if (m.type == Cannon) {
+            r.to[m.source] = ~Board(0); // lines up instead of closing in
+            continue;
+        }
+        // Every stepping piece of a type can capture the same reds
+        if (!(known & (1 << m.type))) {
+            goal_distances(m.type, obstacles, reds, pos, goal[m.type]);
+            known |= 1 << m.type;
+        }
+        const uint8_t *g = goal[m.type];
+
+        Board moves = m.type == Chariot ? attacks_bb<Chariot>(m.source, obstacles) : PseudoAttacks[m.source];
+        for (Square sq : BoardView(moves & ~obstacles)) {
+            if (g[sq] < g[m.source]) {
+                r.to[m.source] |= sq;
+            }
+        }
+
+        // Squares on a shortest way, from here and to a capture
+        for (Square sq : BoardView(m.reached & blacks & ~square_bb(m.source))) {
+            if (m.dist[sq] + g[sq] == g[m.source]) {
+                r.blockers |= sq;
+            }
+        }
+    }
+}
+
+int manhattan_quiet_moves(const Position &pos)
+{
+    Board reds = pos.pieces(Red);
+    if (reds == 0) {
+        return 0;
+    }
+
+    int best = INF;
+    for (Square bp : BoardView(pos.pieces(Black))) {
+        PieceType pt = pos.peek_piece_at(bp).type;
+        for (Square rp : BoardView(reds)) {
+            if (!(pt > pos.peek_piece_at(rp).type)) {
+                continue;
+            }
+            if (pt == Chariot || pt == Cannon) {
+                bool aligned = rank_of(bp) == rank_of(rp) || file_of(bp) == file_of(rp);
+                best         = std::min(best, aligned ? 1 : 2);
+            } else {
+                best = std::min(best, distance(bp, rp));
+            }
+        }
+    }
+    return best == INF ? INF : best - 1;
+}
+
+CaptureTable::CaptureTable(const Position &pos)
+{
+    Board forever = pos.pieces(Duck, Hidden);
+    memset(dist, 255, sizeof(dist));
+
+    for (int chariot = 0; chariot < 2; chariot += 1) {
+        DistanceMap m;
+        for (Square from = SQ_A1; from < SQUARE_NB; from += 1) {
+            if (forever & from) {
+                continue;
+            }
+            // Reuse the map builder with permanent obstacles only
+            m.source = from;
+            m.type   = chariot ? Chariot : Soldier;
+            HeuristicState::build_map(m, forever);
+
+            for (Square target = SQ_A1; target < SQUARE_NB; target += 1) {
+                Board via = (chariot ? attacks_bb<Chariot>(target, forever) : PseudoAttacks[target]) & m.reached;
+                for (Square sq : BoardView(via)) {
+                    dist[chariot][from][target] = std::min<int>(dist[chariot][from][target], m.dist[sq] + 1);
+                }
+            }
+        }
+    }
+}
+
+int CaptureTable::capture_distance(PieceType pt, Square from, Square target) const
+{
+    if (pt == Cannon) {
+        bool aligned = rank_of(from) == rank_of(target) || file_of(from) == file_of(target);
+        return aligned ? 1 : 2;
+    }
+    int d = dist[pt == Chariot][from][target];
+    return d == 255 ? INF : d;
+}
+
+int capture_bound(const Position &pos, const CaptureTable &ct)
+{
+    Board reds = pos.pieces(Red);
+    if (reds == 0) {
+        return 0;
+    }
+
+    Square blacks[MAX_DISTANCE_MAPS];
+    PieceType types[MAX_DISTANCE_MAPS];
+    int n = 0;
+    for (Square bp : BoardView(pos.pieces(Black))) {
+        PieceType pt = pos.peek_piece_at(bp).type;
+        if (pt != Duck) {
+            blacks[n]  = bp;
+            types[n++] = pt;
+        }
+    }
+
+    int farthest = 0;
+    int forcedMoves[MAX_DISTANCE_MAPS] = {};
+    int forcedCount[MAX_DISTANCE_MAPS] = {};
+    for (Square rp : BoardView(reds)) {
+        PieceType rt  = pos.peek_piece_at(rp).type;
+        int best      = INF;
+        int capturer  = -1;
+        int capturers = 0;
+        for (int i = 0; i < n; i += 1) {
+            if (!(types[i] > rt)) {
+                continue;
+            }
+            int d = ct.capture_distance(types[i], blacks[i], rp);
+            if (d < INF) {
+                best = std::min(best, d);
+                capturer = i;
+                capturers += 1;
+            }
+        }
+        if (capturers == 0) {
+            return INF;
+        }
+        farthest = std::max(farthest, best);
+        if (capturers == 1) {
+            // nobody else can do it, so it's on this piece's bill
+            forcedMoves[capturer] = std::max(forcedMoves[capturer], best);
+            forcedCount[capturer] += 1;
+        }
+    }
+
+    int forced = 0;
+    for (int i = 0; i < n; i += 1) {
+        forced += std::max(forcedMoves[i], forcedCount[i]);
+    }
+    return std::max(farthest, forced);
+}
+
+int find_table_dist(Position &pos)
+{
+    HeuristicState hs(pos);
+    return hs.quiet_moves(pos);
+}
@@ -0,0 +1,129 @@
+// Wakasagi: search heuristic
+// ----------------------------------
+// Lower bounds on the moves black still needs, from cheap to expensive:
+//   1. manhattan_quiet_moves()     straight-line distances
+//   2. HeuristicState              distance maps around the obstacles
+//   3. capture_bound()             every red needs a capturer
+// The search stops at the first one that is already too big.
+//
+// Red pieces, ducks and face-down pieces never move in HW1. The distance maps
+// take everything but black pieces as obstacles (black pieces can always step
+// aside), black ducks included among the black pieces: a missing obstacle
+// makes a bound smaller, never wrong. CaptureTable counts every duck.
+// Each black piece keeps a map of how many moves it needs to reach every
+// square. A quiet move only changes the map of the piece that moved; a
+// capture also opens a square, which matters only to maps that bumped into it.
+
+#ifndef HEURISTIC_H
+#define HEURISTIC_H
+
+#include "lib/chess.h"
+#include "lib/types.h"
+
+// Black has at most 16 pieces
+constexpr int MAX_DISTANCE_MAPS = 16;
+
+struct DistanceMap {
+    Square source;
+    PieceType type;
+    Board reached;              // squares with a distance
+    Board frontier;             // obstacles the search ran into
+    uint8_t dist[SQUARE_NB];    // moves from source, valid on _reached_
+    int best;                   // moves to capture the closest red, INF if none
+};
+
+/*
+ * Which quiet moves are worth trying, see HeuristicState::relevance().
+ */
+struct Relevance {
+    Board to[SQUARE_NB]; // by square of a black piece: where it gets closer to a red
+    Board blockers;      // black pieces standing on another piece's shortest path
+
+    bool relevant(Move mv) const { return (blockers & mv.from()) || (to[mv.from()] & mv.to()); }
+};
+
+class HeuristicState {
+    private:
+    DistanceMap maps[MAX_DISTANCE_MAPS];
+    int mapCount;
+    Board obstacles; // everything but black pieces, black ducks included
+    Board reds;
+
+    // Work left over from do_move(), done once someone asks.
+    // One bit per map.
+    uint32_t stale;    // map has to be rebuilt
+    uint32_t unscored; // best has to be recomputed
+
+    void build(DistanceMap &m) const;
+    void score(DistanceMap &m, const Position &pos) const;
+
+    public:
+    /*
+     * Fills in _m_ from its source and type.
+     * @internal
+     */
+    static void build_map(DistanceMap &m, Board obstacles);
+
+    /*
+     * Builds every map from scratch.
+     */
+    explicit HeuristicState(const Position &pos);
+
+    /*
+     * Follows a move made on the position. The maps are only brought up to
+     * date by the next quiet_moves(), so this is cheap if nobody asks.
+     * @param   mv      The move
+     * @param   capture Whether the move captured something
+     */
+    void do_move(Move mv, bool capture);
+
+    /*
+     * @param   pos The position this state follows
+     * @returns Lower bound on the quiet moves black has to make before the
+     *          first capture, INF if no red piece can be captured at all.
+     */
+    int quiet_moves(const Position &pos);
+
+    /*
+     * Finds the quiet moves that shorten some piece's way to a red it can
+     * capture, and the pieces that stand in such a way. Other moves may
+     * still be needed (screens for cannons, making room), so searching only
+     * these can miss solutions.
+     * @param   pos The position this state follows
+     * @param   r   Filled in
+     */
+    void relevance(const Position &pos, Relevance &r);
+};
+
+/*
+ * Same meaning as HeuristicState::quiet_moves(), but only from how far apart
+ * pieces are. Never larger than it.
+ */
+int manhattan_quiet_moves(const Position &pos);
+
+/*
+ * How many moves a piece needs to capture on a square, counting only the
+ * obstacles that stay forever (ducks of either side and face-down pieces,
+ * unlike HeuristicState, which leaves black ducks out).
+ * Build it once per puzzle.
+ */
+struct CaptureTable {
+    uint8_t dist[2][SQUARE_NB][SQUARE_NB]; // [chariot?][from][target], 255 if never
+
+    explicit CaptureTable(const Position &pos);
+
+    /*
+     * @returns Moves needed, the capture included, INF if never
+     */
+    int capture_distance(PieceType pt, Square from, Square target) const;
+};
+
+/*
+ * Lower bound on the whole solution: each red piece has to be reached by
+ * something that can capture it, and the reds only one piece can capture
+ * all add to that piece's moves.
+ * @returns INF if some red piece can never be captured
+ */
+int capture_bound(const Position &pos, const CaptureTable &ct);
+
+#endif
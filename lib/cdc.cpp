@@ -3,11 +3,41 @@
 
 #include "cdc.h"
 
+#include <atomic>
+
 std::ostream &info  = std::cout;
 std::ostream &error = std::cerr;
 std::ostream &debug = std::cerr;
 
-pcg32 rng(pcg_extras::seed_seq_from<std::random_device>{});
+// Threads' own generators are the streams from here up, rng_stream() ids
+// stay below. pcg32 keeps 63 bits of the stream number.
+constexpr uint64_t THREAD_STREAMS = 1ULL << 62;
+
+static uint64_t random_seed()
+{
+    std::random_device rd;
+    return (uint64_t(rd()) << 32) | rd();
+}
+
+static std::atomic<uint64_t> masterSeed(random_seed());
+static std::atomic<uint64_t> threadStreams(0);
+
+thread_local pcg32 rng(masterSeed.load(), THREAD_STREAMS + threadStreams++);
+
+void seed_rng(uint64_t seed)
+{
+    pcg32 &mine   = rng; // started before the counter goes back, if not yet
+    masterSeed    = seed;
+    threadStreams = 0;
+    mine          = pcg32(seed, THREAD_STREAMS + threadStreams++);
+}
+
+pcg32 rng_stream(uint64_t id, uint64_t skip)
+{
+    pcg32 r(masterSeed.load(), id);
+    r.advance(skip);
+    return r;
+}
 
 std::vector<std::string> split_fen(const std::string &fen)
 {
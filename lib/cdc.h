@@ -19,10 +19,27 @@ extern std::ostream &error; // This is stderr
 extern std::ostream &debug; // This is also stderr
 
 /*
- * Pseudo-random number generator provided by PCG.
+ * Pseudo-random number generator provided by PCG, one per thread so no two
+ * threads share its state. Each is a stream of its own off one master seed,
+ * random unless set with seed_rng().
  * @global
  */
-extern pcg32 rng;
+extern thread_local pcg32 rng;
+
+/*
+ * Sets the master seed (--seed S) and restarts the calling thread's rng
+ * from it, for runs that come out the same every time. Threads that draw
+ * their first number after this get streams of the new seed too.
+ */
+void seed_rng(uint64_t seed);
+
+/*
+ * Stream _id_ of the master seed, independent of every other stream and of
+ * the threads' own. For work split up by index: item _id_ draws the same
+ * numbers whichever thread gets it.
+ * @param   skip    Numbers to jump over, without drawing them
+ */
+pcg32 rng_stream(uint64_t id, uint64_t skip = 0);
 
 /*
  * Vector syntax sugar so we can do `vec << stuff, more_stuff`
@@ -9,7 +9,6 @@
 #include <cstddef>
 #include <ostream>
 #include <string>
-#include <unordered_map>
 
 const char PIECE2CHAR[SIDE_NB][REAL_PIECE_TYPE_NB] = {
     { 'K', 'A', 'E', 'R', 'N', 'C', 'P', 'D', '?' },
@@ -26,30 +25,28 @@ const std::string PIECE2WIDECHAR[SIDE_NB][REAL_PIECE_TYPE_NB] = {
 #endif
 };
 
-const std::unordered_map<char, Piece> CHAR2PIECE = {
-    { '?', Piece(Mystery,   Hidden) },
-    { 'K',   Piece(Black,  General) },
-    { 'k',     Piece(Red,  General) },
-    { 'A',   Piece(Black,  Advisor) },
-    { 'a',     Piece(Red,  Advisor) },
-    { 'E',   Piece(Black, Elephant) },
-    { 'e',     Piece(Red, Elephant) },
-    { 'R',   Piece(Black,  Chariot) },
-    { 'r',     Piece(Red,  Chariot) },
-    { 'N',   Piece(Black,    Horse) },
-    { 'n',     Piece(Red,    Horse) },
-    { 'C',   Piece(Black,   Cannon) },
-    { 'c',     Piece(Red,   Cannon) },
-    { 'P',   Piece(Black,  Soldier) },
-    { 'p',     Piece(Red,  Soldier) },
-    { 'D',   Piece(Black,     Duck) },
-    { 'd',     Piece(Red,     Duck) },
-};
-
 uint8_t SquareDistance[SQUARE_NB][SQUARE_NB];
 
 Board PseudoAttacks[SQUARE_NB];
 
+Key ZobristPsq[Mystery + 1][REAL_PIECE_TYPE_NB][SQUARE_NB];
+Key ZobristSide;
+
+void init_zobrist()
+{
+    pcg32 zrng(0x5A0B7157ULL); // fixed seed: keys may be stored on disk
+
+    auto next_key = [&]() { return (Key(zrng()) << 32) | zrng(); };
+    for (int side = Black; side <= Mystery; side += 1) {
+        for (PieceType pt = General; pt < REAL_PIECE_TYPE_NB; pt += 1) {
+            for (Square sq = SQ_A1; sq < SQUARE_NB; sq += 1) {
+                ZobristPsq[side][pt][sq] = next_key();
+            }
+        }
+    }
+    ZobristSide = next_key();
+}
+
 std::ostream &operator<<(std::ostream &os, const Square &sq)
 {
     os << (char)('A' + file_of(sq)) << (1 + rank_of(sq));
@@ -134,9 +131,9 @@ Board attacks_bb(PieceType pt, Square sq, Board occupied)
 std::ostream &operator<<(std::ostream &os, const Move &mv)
 {
     if (mv.type() == Flipping) {
-        os << "FLIP " << mv.from() << std::endl;
+        os << "FLIP " << mv.from() << "\n";
     } else {
-        os << "MOVE " << mv.from() << " " << mv.to() << std::endl;
+        os << "MOVE " << mv.from() << " " << mv.to() << "\n";
     }
     return os;
 }
@@ -188,8 +185,13 @@ void Position::clear()
         board[sq] = Piece();
     }
 
+    info.key            = 0;
+    info.psq            = 0;
     info.fiftyMoveCount = 0;
+    info.repetitions    = 0;
     info.illegal        = NO_COLOR;
+    keyHistory          = nullptr;
+    historyPly          = 0;
     info.time_remaining = std::pair(0.0, 0.0);
 }
 
@@ -211,6 +213,8 @@ void Position::place_piece_at(const Piece &p, Square sq)
     }
 
     board[sq] = p;
+    info.key ^= ZobristPsq[p.side][p.type][sq];
+    info.psq += PSQ.score[p.side][p.type][sq];
 
     byTypeBB[p.type] |= sq;
     byTypeBB[ALL_PIECES] |= sq;
@@ -226,6 +230,8 @@ Piece Position::remove_piece_at(Square sq)
 {
     Piece p   = board[sq];
     board[sq] = Piece();
+    info.key ^= ZobristPsq[p.side][p.type][sq];
+    info.psq -= PSQ.score[p.side][p.type][sq];
 
     byTypeBB[p.type] ^= sq;
     byTypeBB[ALL_PIECES] ^= sq;
@@ -238,42 +244,47 @@ Piece Position::remove_piece_at(Square sq)
     return p;
 }
 
-bool Position::flip_piece_at(Square sq)
+bool Position::flip_piece_at(Square sq, pcg32 &r)
 {
     if (peek_piece_at(sq).side != Mystery) {
         return false;
     }
-    Piece new_piece =
-        pieceCollection.empty() ? random_faceup_piece() : sample_remove(pieceCollection);
+    Piece new_piece = pieceCollection.empty() ? random_faceup_piece(r) : pieceCollection.sample(r);
+    pieceCollection.take(new_piece);
 
     place_piece_at(new_piece, sq);
     return true;
 }
 
+bool Position::reveal_piece_at(Square sq, const Piece &p)
+{
+    if (peek_piece_at(sq).side != Mystery) {
+        return false;
+    }
+    pieceCollection.take(p);
+    place_piece_at(p, sq);
+    return true;
+}
+
 void Position::add_collection(Piece *set, size_t n)
 {
     if (set == nullptr) {
         // use default piece set
         for (Color s : { Color::Red, Color::Black }) {
-            // clang-format off
-            pieceCollection
-                << Piece(s, General)
-                << Piece(s, Advisor)  << Piece(s, Advisor)
-                << Piece(s, Elephant) << Piece(s, Elephant)
-                << Piece(s, Chariot)  << Piece(s, Chariot)
-                << Piece(s, Horse)    << Piece(s, Horse)
-                << Piece(s, Cannon)   << Piece(s, Cannon)
-                << Piece(s, Soldier)  << Piece(s, Soldier)
-                << Piece(s, Soldier)  << Piece(s, Soldier)
-                << Piece(s, Soldier);
-            // clang-format on
+            pieceCollection.add(Piece(s, General));
+            pieceCollection.add(Piece(s, Advisor), 2);
+            pieceCollection.add(Piece(s, Elephant), 2);
+            pieceCollection.add(Piece(s, Chariot), 2);
+            pieceCollection.add(Piece(s, Horse), 2);
+            pieceCollection.add(Piece(s, Cannon), 2);
+            pieceCollection.add(Piece(s, Soldier), 5);
         }
         return;
     }
 
     // Use provided n pieces
     for (int i = 0; i < n; i += 1) {
-        pieceCollection << set[i];
+        pieceCollection.add(set[i]);
     }
 }
 
@@ -290,71 +301,147 @@ void Position::setup(int hidden)
     }
 }
 
-void Position::readFEN(std::string fen)
+// FEN character -> piece, NO_PIECE for everything else
+static constexpr std::array<Piece, 256> make_fen_pieces()
 {
-    auto tokens = split_fen(fen);
-    if (tokens.size() != 5) {
-        error << "Warning: FEN string does not have 5 parts.\n";
+    std::array<Piece, 256> table {};
+    const char *black = "KAERNCPD"; // same order as PieceType
+    const char *red   = "kaerncpd";
+    for (int pt = General; pt <= Duck; pt += 1) {
+        table[(unsigned char)black[pt]] = Piece(Black, PieceType(pt));
+        table[(unsigned char)red[pt]]   = Piece(Red, PieceType(pt));
     }
+    table['?'] = Piece(Mystery, Hidden);
+    return table;
+}
+static constexpr std::array<Piece, 256> FEN_PIECES = make_fen_pieces();
 
-    int i     = 0;
-    Square sq = SQ_A1;
-    for (auto token : tokens) {
-        if (i == 4) {
-            sideToMove = (token.compare("b") == 0) ? Black : Red;
-            break;
-        }
-        // parse a rank
-        for (char &c : token) {
-            if (CHAR2PIECE.find(c) == CHAR2PIECE.end()) {
-                int empty_count = c - '0';
-                if (empty_count < 1 || empty_count > 8) {
-                    error << "Warning: invalid FEN. \"" << c << "\"\n";
-                    return;
-                }
-                sq += empty_count;
-            } else {
-                place_piece_at(CHAR2PIECE.at(c), sq);
-                sq += 1;
-            }
+bool Position::readFEN(std::string_view fen)
+{
+    // Ranks from 1 up, separated by '/', then the side to move:
+    // "K1p5/8/2D5/4c2R b"
+    size_t i    = 0;
+    int slashes = 0;
+    Square sq   = SQ_A1;
+    for (; i < fen.size() && fen[i] != ' ' && fen[i] != '\t'; i += 1) {
+        char c  = fen[i];
+        Piece p = FEN_PIECES[(unsigned char)c];
+        if (c == '/') {
+            slashes += 1;
+        } else if (p.type != NO_PIECE && sq < SQUARE_NB) {
+            place_piece_at(p, sq);
+            sq += 1;
+        } else if ('1' <= c && c <= '8') {
+            sq += c - '0';
+        } else {
+            error << "Warning: invalid FEN. \"" << c << "\"\n";
+            return false;
         }
+    }
+
+    while (i < fen.size() && (fen[i] == ' ' || fen[i] == '\t')) {
         i += 1;
     }
+    std::string_view side = fen.substr(i, fen.find_first_of(" \t\r\n", i) - i);
+    sideToMove            = side == "b" ? Black : Red;
+
+    if (slashes != 3 || side.empty()) {
+        error << "Warning: FEN string does not have 5 parts.\n";
+        return false;
+    }
+    return true;
 }
 
-std::string Position::toFEN()
+size_t Position::toFEN(char *buf) const
 {
-    short empty_count = 0;
-    std::string fen;
-    for (Square sq = SQ_A1; sq < SQUARE_NB; sq += 1) {
-        Piece p = peek_piece_at(sq);
-        if (p.type == NO_PIECE) {
-            empty_count += 1;
-        }
-        if (p.type != NO_PIECE || file_of(sq) == FILE_H) {
-            if (empty_count > 0) {
-                fen += std::to_string(empty_count);
+    char *out = buf;
+    for (int r = RANK_1; r <= RANK_4; r += 1) {
+        int empty = 0;
+        for (int f = FILE_A; f <= FILE_H; f += 1) {
+            Piece p = board[make_square(File(f), Rank(r))];
+            if (p.type == NO_PIECE) {
+                empty += 1;
+                continue;
             }
-            empty_count = 0;
-            if (p.type != NO_PIECE) {
-                fen += (char)p;
+            if (empty) {
+                *out++ = '0' + empty;
             }
+            empty  = 0;
+            *out++ = (char)p;
         }
-        if (sq == SQ_H1 || sq == SQ_H2 || sq == SQ_H3) {
-            fen += '/';
+        if (empty) {
+            *out++ = '0' + empty;
         }
+        *out++ = r == RANK_4 ? ' ' : '/';
+    }
+    *out++ = due_up() == Black ? 'b' : 'r';
+    *out   = '\0';
+    return out - buf;
+}
+
+std::string Position::toFEN() const
+{
+    char buf[FEN_BUFFER_SIZE];
+    return std::string(buf, toFEN(buf));
+}
+
+void Position::attach_history(Key *history)
+{
+    if (history && keyHistory) {
+        std::copy(keyHistory, keyHistory + KEY_HISTORY_SIZE, history);
+    } else {
+        historyPly = 0; // a new game as far as repetitions go
+    }
+    keyHistory = history;
+    if (keyHistory) {
+        keyHistory[historyPly % KEY_HISTORY_SIZE] = key();
     }
-    fen += (due_up() == Black) ? " b" : " r";
-    return fen;
 }
 
-bool Position::do_move(const Move &mv)
+// After a move: pushes the new key, and counts its repetitions. A capture
+// or a flip can't be undone, so only the plies since the last one can be
+// the same position, and only every other one has the same side to move.
+void Position::record_key()
+{
+    info.repetitions = 0;
+    if (!keyHistory) {
+        return;
+    }
+    historyPly += 1;
+    Key k = key();
+    keyHistory[historyPly % KEY_HISTORY_SIZE] = k;
+
+    int step = gameRules == FullGame ? 2 : 1;
+    int back = std::min({ info.fiftyMoveCount, historyPly, KEY_HISTORY_SIZE - 1 });
+    for (int i = step; i <= back; i += step) {
+        info.repetitions += keyHistory[(historyPly - i) % KEY_HISTORY_SIZE] == k;
+    }
+}
+
+bool Position::do_move(const Move &mv, const Piece &revealed)
+{
+    if (mv.type() != Flipping || gameRules == HW1Rules || !reveal_piece_at(mv.from(), revealed)) {
+        return false;
+    }
+    info.fiftyMoveCount = 0;
+    sideToMove          = ~sideToMove;
+    record_key();
+    return true;
+}
+
+bool Position::do_move(const Move &mv, pcg32 &r)
 {
     bool success = false;
 
     // == Flip ==
     if (mv.type() == Flipping) {
-        return false; // hw1
+        if (gameRules == HW1Rules || !flip_piece_at(mv.from(), r)) {
+            return false; // hw1
+        }
+        info.fiftyMoveCount = 0;
+        sideToMove          = ~sideToMove;
+        record_key();
+        return true;
     }
 
     // == Move ==
@@ -388,7 +475,10 @@ bool Position::do_move(const Move &mv)
     remove_piece_at(from);
     place_piece_at(p, to);
 
-    // sideToMove = ~sideToMove; // hw1
+    if (gameRules == FullGame) {
+        sideToMove = ~sideToMove; // hw1 keeps black on the move
+    }
+    record_key();
     return true;
 }
 
@@ -409,6 +499,29 @@ double Position::time_left(Color color) const
 
 Color Position::winner(WinCon *wc) const
 {
+    if (gameRules == FullGame) {
+        // Out of pieces, with nothing left face-down to come back from
+        Board hidden = pieces(Hidden);
+        for (Color c : { Red, Black }) {
+            if (!(pieces(c) & ~pieces(Duck)) && !hidden) {
+                if (wc) {
+                    *wc = WinCon::Elimination;
+                }
+                return ~c;
+            }
+        }
+        // Stuck
+        MoveList moves(*this);
+        if (moves.size() == 0) {
+            if (wc) {
+                *wc = WinCon::DeadPosition;
+            }
+            return ~sideToMove;
+        }
+        drawn(wc);
+        return NO_COLOR;
+    }
+
     // HW1 special
 
     // No legal moves for you: bad
@@ -430,6 +543,27 @@ Color Position::winner(WinCon *wc) const
     return NO_COLOR;
 }
 
+bool Position::drawn(WinCon *wc) const
+{
+    if (gameRules != FullGame) {
+        return false;
+    }
+    // Counted when the move was made, nothing to look up
+    if (info.repetitions >= 2) {
+        if (wc) {
+            *wc = WinCon::Threefold;
+        }
+        return true;
+    }
+    if (info.fiftyMoveCount >= FIFTY_MOVE_PLIES) {
+        if (wc) {
+            *wc = WinCon::FiftyMoves;
+        }
+        return true;
+    }
+    return false;
+}
+
 // Print out your position easily
 #define TEXT_RED "\033[31m"
 #define TEXT_RST "\033[0m"
@@ -6,15 +6,18 @@
 #define CHESS_H
 
 #include "cdc.h"
+#include "eval.h"
 #include "movegen.h"
 #include "types.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <csignal>
 #include <cstdint>
 #include <cstring>
 #include <optional>
+#include <string_view>
 
 // -~ Colors ~-
 
@@ -140,7 +143,7 @@ struct Piece {
     /*
      * No piece.
      */
-    Piece()
+    constexpr Piece()
       : side(Color::NO_COLOR)
       , type(PieceType::NO_PIECE)
     {}
@@ -148,7 +151,7 @@ struct Piece {
     /*
      * Yes piece.
      */
-    Piece(Color side, PieceType type)
+    constexpr Piece(Color side, PieceType type)
       : side(side)
       , type(type)
     {
@@ -178,11 +181,103 @@ struct Piece {
     }
 };
 
-inline Piece random_faceup_piece()
+// The longest FEN toFEN() writes: 32 pieces, 3 slashes, the side to move
+// and the null terminator
+constexpr size_t FEN_BUFFER_SIZE = 40;
+
+inline Piece random_faceup_piece(pcg32 &r = rng)
 {
-    return Piece(Color(rng(SIDE_NB)), PieceType(rng(MOVABLE_PIECE_TYPE_NB)));
+    return Piece(Color(r(SIDE_NB)), PieceType(r(MOVABLE_PIECE_TYPE_NB)));
 }
 
+// -~ PieceBag ~-
+
+/*
+ * The pieces face-down pieces may turn out to be, as a count of each.
+ * Small enough to copy with every Position; everything is O(1).
+ */
+class PieceBag {
+    private:
+    uint8_t counts[SIDE_NB][MOVABLE_PIECE_TYPE_NB];
+    uint8_t total;
+    int16_t material; // see worth()
+
+    public:
+    PieceBag() { clear(); }
+
+    void clear()
+    {
+        memset(counts, 0, sizeof(counts));
+        total    = 0;
+        material = 0;
+    }
+
+    /*
+     * @param   p   A face-up piece, not a duck. Anything else is ignored.
+     */
+    void add(const Piece &p, int n = 1)
+    {
+        if (unsigned(p.side) >= SIDE_NB || unsigned(p.type) >= MOVABLE_PIECE_TYPE_NB) {
+            return;
+        }
+        counts[p.side][p.type] += n;
+        total += n;
+        material += n * piece_worth(p.side, p.type);
+    }
+
+    /*
+     * Takes one _p_ out, undone by add(p).
+     * @returns false if there is none
+     */
+    bool take(const Piece &p)
+    {
+        if (count(p) == 0) {
+            return false;
+        }
+        counts[p.side][p.type] -= 1;
+        total -= 1;
+        material -= piece_worth(p.side, p.type);
+        return true;
+    }
+
+    int count(const Piece &p) const
+    {
+        return p.side < SIDE_NB && p.type < MOVABLE_PIECE_TYPE_NB ? counts[p.side][p.type] : 0;
+    }
+    int size() const { return total; }
+
+    /*
+     * @returns The PIECE_VALUE of everything in the bag, Black's minus Red's
+     */
+    int worth() const { return material; }
+    bool empty() const { return total == 0; }
+
+    /*
+     * @returns The odds that a flip reveals _p_, 0 if the bag is empty
+     */
+    double probability(const Piece &p) const { return total ? double(count(p)) / total : 0.0; }
+
+    /*
+     * Picks a piece, each as likely as its count. Leaves it in the bag.
+     * @param   r   Random numbers to use. The bag must not be empty.
+     */
+    template<typename Rng>
+    Piece sample(Rng &r) const
+    {
+        assert(total > 0);
+        int k = r(uint32_t(total));
+        for (int c = 0; c < SIDE_NB; c += 1) {
+            for (int pt = 0; pt < MOVABLE_PIECE_TYPE_NB; pt += 1) {
+                k -= counts[c][pt];
+                if (k < 0) {
+                    return Piece(Color(c), PieceType(pt));
+                }
+            }
+        }
+        return Piece(); // unreachable
+    }
+};
+
 // -~ Boards ~-
 
 // Attack bitboards for normal pieces (we only have one type in CDC)
@@ -257,11 +352,37 @@ template<PieceType pt>
 Board attacks_bb(Square sq, Board occupied);
 Board attacks_bb(PieceType pt, Square sq, Board occupied);
 
+// -~ Zobrist keys ~-
+// One random key per (side, type, square), side being Black, Red or Mystery.
+// Filled in with a fixed seed, so keys are the same from run to run.
+extern Key ZobristPsq[Mystery + 1][REAL_PIECE_TYPE_NB][SQUARE_NB];
+extern Key ZobristSide; // Red to play
+
+/*
+ * Fills the Zobrist tables.
+ * @internal
+ */
+void init_zobrist();
+
 // -~ Move ~-
 std::ostream &operator<<(std::ostream &os, const Move &mv);
 std::istream &operator>>(std::istream &is, Move &mv);
 
 // -~ Position ~-
+
+// Which game do_move() and winner() play
+enum Rules {
+    HW1Rules, // black moves alone until every red piece is captured
+    FullGame, // sides take turns, flips draw from the bag
+};
+
+// Plies without a capture or flip that draw a FullGame
+constexpr int FIFTY_MOVE_PLIES = 100;
+
+// Keys a history holds, a ring: the fifty-move window, plus a search's
+// worth of plies written past the end of the game
+constexpr int KEY_HISTORY_SIZE = 256;
+
 class Position {
     private:
     // Boards
@@ -270,8 +391,13 @@ class Position {
     Board byColorBB[SIDE_NB];
     // Data
     Color sideToMove;
-    std::vector<Piece> pieceCollection;
+    Rules gameRules = HW1Rules;
+    PieceBag pieceCollection;
     StateInfo info;
+    Key *keyHistory = nullptr; // see attach_history()
+    int historyPly  = 0;
+
+    void record_key();
 
     public:
     /*
@@ -287,7 +413,7 @@ class Position {
      * A board initialized with a FEN string
      * @param   fen The FEN string
      */
-    Position(std::string fen)
+    Position(std::string_view fen)
     {
         clear();
         readFEN(fen);
@@ -318,15 +444,60 @@ class Position {
     void clear_collection() { pieceCollection.clear(); }
 
     /*
-     * Makes a position from a FEN-like string.
+     * @returns How many of _p_ are left in the bag
+     */
+    int collection_count(Piece p) const { return pieceCollection.count(p); }
+
+    /*
+     * The bag itself, for odds and sampling.
+     */
+    const PieceBag &collection() const { return pieceCollection; }
+
+    /*
+     * The fifty-move counter: moves since the last capture.
+     */
+    int fifty_move_count() const { return info.fiftyMoveCount; }
+    void set_fifty_move_count(int n) { info.fiftyMoveCount = n; }
+
+    /*
+     * Keeps the key of this position and of every one do_move() leads to in
+     * _history_, KEY_HISTORY_SIZE keys, for finding repetitions. Copies write
+     * to the same history at their own ply, so a copy-make search can share
+     * one as long as it plays a line out before the next. Threads need one
+     * each. What the old history had is copied over; nullptr stops keeping
+     * one. clear() stops too.
+     */
+    void attach_history(Key *history);
+
+    /*
+     * @returns How many times this position came up before, the same side
+     *          to move, since the last capture or flip. 0 without a history.
+     */
+    int repetitions() const { return info.repetitions; }
+
+    /*
+     * @returns The material and piece-square scores of the face-up pieces
+     *          (see eval.h), in Black's favour. Kept up to date by
+     *          place_piece_at() and remove_piece_at().
+     */
+    int psq_score() const { return info.psq; }
+
+    /*
+     * Makes a position from a FEN-like string, in one pass and without
+     * allocating. Warns on stderr if the string is malformed.
      * @internal
+     * @returns false if the string is malformed
      */
-    void readFEN(std::string fen);
+    bool readFEN(std::string_view fen);
 
     /*
      * Writes the board to a FEN-like string.
+     * @param   buf Room for at least FEN_BUFFER_SIZE characters, gets a
+     *              null-terminated string
+     * @returns Length of the string
      */
-    std::string toFEN();
+    size_t toFEN(char *buf) const;
+    std::string toFEN() const;
 
     /*那
      * Fills the board with pieces to start.
@@ -336,16 +507,40 @@ class Position {
 
     /*
      * Check winner, pass a WinCon if you want to know how the game ended too
-     * @param   wc  Ignored in HW1
+     * @param   wc  Ignored in HW1. Set for a draw too, left alone while the
+     *              game goes on.
      * @returns Red/Black   if all black/non-duck-red pieces have been eliminated
-     *          NO_COLOR    if the above is not true
+     *                      (FullGame: or the side to play has no move left)
+     *          NO_COLOR    if the above is not true: the game goes on, or is
+     *                      drawn. Ask drawn() to tell the two apart.
      */
     Color winner(WinCon *wc = nullptr) const;
 
+    /*
+     * Whether a FullGame is drawn: FIFTY_MOVE_PLIES without a capture or a
+     * flip, or the third time the same position comes up (needs a history,
+     * see attach_history()). Never in HW1.
+     * @param   wc  Gets FiftyMoves or Threefold if drawn
+     */
+    bool drawn(WinCon *wc = nullptr) const;
+
     /*
      * @returns Red/Black   The color to play.
      */
     Color due_up() const { return sideToMove; }
+    void set_side_to_move(Color c) { sideToMove = c; }
+
+    /*
+     * The rules in play, HW1Rules unless set otherwise. Kept by clear().
+     */
+    Rules rules() const { return gameRules; }
+    void set_rules(Rules r) { gameRules = r; }
+
+    /*
+     * @returns A Zobrist hash of the pieces on the board and the side to play.
+     *          Kept up to date by place_piece_at() and remove_piece_at().
+     */
+    Key key() const { return info.key ^ (sideToMove == Red ? ZobristSide : 0); }
 
     /*
      * Gets the time remaining.
@@ -467,14 +662,43 @@ class Position {
      *          If you make multiple copies of this position and run this function
      *          on the same square on each, it may well yield different pieces.
      */
-    bool flip_piece_at(Square sq);
+    bool flip_piece_at(Square sq) { return flip_piece_at(sq, rng); }
+
+    /*
+     * Same, drawing with _r_ instead of the global generator, so threads
+     * can flip without sharing one.
+     */
+    bool flip_piece_at(Square sq, pcg32 &r);
 
     /*
-     * Performs a move.
+     * Flips a face-down piece into a chosen piece, which leaves the bag.
+     * The deterministic flip_piece_at(), for searching every outcome.
+     * @param   sq  The square
+     * @param   p   The piece it turns out to be. Needn't be in the bag:
+     *              an empty bag reveals anything (see random_faceup_piece()).
+     * @returns Whether the flip was successful
+     */
+    bool reveal_piece_at(Square sq, const Piece &p);
+
+    /*
+     * Performs a move. Under FullGame rules flips work too, and the turn
+     * passes to the other side.
      * @param   mv  The move to perform
      * @return  Whether the move was successful
      */
-    bool do_move(const Move &mv);
+    bool do_move(const Move &mv) { return do_move(mv, rng); }
+
+    /*
+     * Same, flips draw with _r_, see flip_piece_at().
+     */
+    bool do_move(const Move &mv, pcg32 &r);
+
+    /*
+     * Performs a flip that reveals _revealed_, see reveal_piece_at().
+     * FullGame rules only.
+     * @return  Whether the flip was successful
+     */
+    bool do_move(const Move &mv, const Piece &revealed);
 };
 
 std::ostream &operator<<(std::ostream &os, const Position &pos);
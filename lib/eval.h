@@ -0,0 +1,61 @@
+// Chinese Dark Chess: evaluation terms
+// ----------------------------------
+// The weights of the static evaluation, all constexpr: change one and the
+// tables built from it follow at compile time.
+//
+// Material and piece-square scores are summed up in one table that
+// Position keeps a running total of (see Position::psq_score()), and the bag
+// keeps the material it holds (see PieceBag::worth()). Both count in
+// Black's favour.
+
+#ifndef EVAL_H
+#define EVAL_H
+
+#include "types.h"
+
+#include <algorithm>
+
+// Material, in the order of PieceType
+constexpr int PIECE_VALUE[MOVABLE_PIECE_TYPE_NB] = { 600, 270, 180, 90, 50, 200, 60 };
+
+// Per step in from the edge of the board, files and ranks counted apart
+constexpr int CENTER_WEIGHT[MOVABLE_PIECE_TYPE_NB] = { 4, 2, 2, 6, 6, 3, 4 };
+
+// Per square a face-up piece can move to or capture on
+constexpr int MOBILITY_WEIGHT[MOVABLE_PIECE_TYPE_NB] = { 3, 2, 2, 2, 3, 1, 2 };
+
+// What a face-down piece counts for, in percent of what the bag says it is
+// on average
+constexpr int HIDDEN_PERCENT = 100;
+
+constexpr int piece_worth(Color c, PieceType pt)
+{
+    return c == Black ? PIECE_VALUE[pt] : c == Red ? -PIECE_VALUE[pt] : 0;
+}
+
+// Material plus position, by (side, type, square). Face-down pieces and
+// ducks are worth nothing here.
+struct PsqTable {
+    int score[Mystery + 1][REAL_PIECE_TYPE_NB][SQUARE_NB];
+};
+
+constexpr PsqTable make_psq_table()
+{
+    PsqTable t {};
+    for (int c = Black; c <= Red; c += 1) {
+        for (int pt = General; pt <= Soldier; pt += 1) {
+            for (int sq = 0; sq < SQUARE_NB; sq += 1) {
+                int file   = sq % FILE_NB;
+                int rank   = sq / FILE_NB;
+                int inward = std::min(file, FILE_NB - 1 - file) + std::min(rank, RANK_NB - 1 - rank);
+                int score  = PIECE_VALUE[pt] + CENTER_WEIGHT[pt] * inward;
+                t.score[c][pt][sq] = c == Black ? score : -score;
+            }
+        }
+    }
+    return t;
+}
+
+constexpr PsqTable PSQ = make_psq_table();
+
+#endif
@@ -67,6 +67,7 @@ enum PieceType {
 
 struct Piece;
 using Board = uint32_t;
+using Key   = uint64_t;
 
 struct BoardView {
     struct Iterator {
@@ -192,7 +193,10 @@ class WinCon {
 // -~ StateInfo ~-
 // Records various stats about a position
 struct StateInfo {
+    Key key; // Zobrist key of the pieces on the board (side to move excluded)
+    int psq; // PSQ scores of the pieces on the board, see eval.h
     int fiftyMoveCount;
+    int repetitions; // earlier times in the key history, see Position::attach_history()
     Color illegal;
     std::pair<double, double> time_remaining; // RED, BLACK
 };
@@ -0,0 +1,366 @@
+// Wakasagi: Monte Carlo tree search
+// ----------------------------------
+
+#include "mcts.h"
+#include "parallel.h"
+#include "solver.h"
+
+#include <cmath>
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+constexpr int MAX_PATH     = 512;
+constexpr uint64_t DEFAULT_PLAYOUTS = 10000; // when there is no budget at all
+
+enum NodeState : uint8_t { LEAF, EXPANDING, EXPANDED };
+
+struct MctsNode {
+    std::atomic<uint32_t> visits; // threads still on their way back included
+    std::atomic<uint32_t> score;  // half points for the side that moved here
+    std::atomic<uint8_t> state;
+    bool chance;                  // a flip: the children are what it may reveal
+    uint8_t weight;               // a flip's child: how many of it in the bag
+    uint16_t childCount;
+    uint32_t firstChild;
+    Move move;                    // from the parent (the flip, for its children)
+    Piece revealed;               // a flip's child: the piece
+    float prior;
+
+    void init(Move mv, bool isChance, const Piece &p, uint8_t w, float pr)
+    {
+        visits.store(0, std::memory_order_relaxed);
+        score.store(0, std::memory_order_relaxed);
+        state.store(LEAF, std::memory_order_relaxed);
+        chance     = isChance;
+        weight     = w;
+        childCount = 0;
+        firstChild = NO_NODE;
+        move       = mv;
+        revealed   = p;
+        prior      = pr;
+    }
+
+    void copy_from(const MctsNode &o)
+    {
+        init(o.move, o.chance, o.revealed, o.weight, o.prior);
+        visits.store(o.visits.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        score.store(o.score.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        state.store(o.state.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        childCount = o.childCount;
+    }
+};
+
+static bool is_capture(const Position &pos, Move mv)
+{
+    return mv.type() == Moving && pos.peek_piece_at(mv.to()).type != NO_PIECE;
+}
+
+// Random play to the end. Half of the moves are captures when there are
+// any: purely random games hardly ever end. Fifty moves without a capture
+// is a draw.
+static Color rollout(Position &pos, pcg32 &r, int maxPlies)
+{
+    for (int ply = 0; ply < maxPlies && !pos.drawn(); ply += 1) {
+        MoveList moves(pos);
+        int n = moves.size();
+        if (n == 0) {
+            return ~pos.due_up();
+        }
+        Move mv = moves.begin()[r(n)];
+        if (r(2)) {
+            int seen = 0;
+            for (Move c : moves) {
+                if (is_capture(pos, c) && r(++seen) == 0) {
+                    mv = c;
+                }
+            }
+        }
+        pos.do_move(mv, r);
+    }
+    return NO_COLOR;
+}
+
+MctsTree::MctsTree(const MctsOptions &opt)
+  : opt(opt)
+  , used(0)
+  , root(NO_NODE)
+{
+    capacity = std::min<size_t>((opt.memoryMB << 20) / sizeof(MctsNode), NO_NODE - 1);
+    capacity = std::max<uint32_t>(capacity, 1);
+    pool.reset(new MctsNode[capacity]);
+    for (unsigned i = 0; i < thread_count(opt.threads); i += 1) {
+        rngs.push_back(rng_stream(i));
+    }
+}
+
+MctsTree::~MctsTree() = default;
+
+uint32_t MctsTree::allocate(uint32_t n)
+{
+    if (used.load(std::memory_order_relaxed) + n > capacity) {
+        return NO_NODE;
+    }
+    uint32_t first = used.fetch_add(n);
+    return first + n <= capacity ? first : NO_NODE;
+}
+
+void MctsTree::reset(const Position &pos)
+{
+    used.store(0);
+    root = allocate(1);
+    pool[root].init(Move(0), false, Piece(), 0, 1.0f);
+    rootPos = pos;
+    hasRoot = true;
+}
+
+// One thread gets to expand a leaf, the others play out from it meanwhile
+bool MctsTree::expand(uint32_t node, const Position &pos)
+{
+    MctsNode &n      = pool[node];
+    uint8_t expected = LEAF;
+    if (!n.state.compare_exchange_strong(expected, EXPANDING, std::memory_order_acquire)) {
+        return false;
+    }
+
+    uint32_t first = NO_NODE;
+    int count      = 0;
+    if (n.chance) {
+        // What the flip may reveal, as the bag has it
+        const PieceBag &bag = pos.collection();
+        Piece pieces[2 * MOVABLE_PIECE_TYPE_NB];
+        uint8_t weights[2 * MOVABLE_PIECE_TYPE_NB];
+        for (Color c : { Black, Red }) {
+            for (int pt = General; pt <= Soldier; pt += 1) {
+                Piece p(c, PieceType(pt));
+                int k = bag.empty() ? 1 : bag.count(p); // empty: anything, evenly
+                if (k > 0) {
+                    pieces[count]    = p;
+                    weights[count++] = k;
+                }
+            }
+        }
+        first = allocate(count);
+        for (int i = 0; first != NO_NODE && i < count; i += 1) {
+            pool[first + i].init(n.move, false, pieces[i], weights[i], 0.0f);
+        }
+    } else {
+        // Captures get a head start, by what they take
+        MoveList moves(pos);
+        count = moves.size();
+        float weights[MAX_MOVES];
+        float total = 0;
+        for (int i = 0; i < count; i += 1) {
+            Move mv = moves.begin()[i];
+            weights[i] = is_capture(pos, mv) ? 2.0f + (pos.peek_piece_at(mv.to()).type == General) : 1.0f;
+            total += weights[i];
+        }
+        first = allocate(count);
+        for (int i = 0; first != NO_NODE && i < count; i += 1) {
+            Move mv = moves.begin()[i];
+            pool[first + i].init(mv, mv.type() == Flipping, Piece(), 0, weights[i] / total);
+        }
+    }
+
+    if (first == NO_NODE && count > 0) {
+        n.state.store(LEAF, std::memory_order_release); // arena is full, stays a leaf
+        return false;
+    }
+    n.firstChild = first;
+    n.childCount = count;
+    n.state.store(EXPANDED, std::memory_order_release);
+    return true;
+}
+
+void MctsTree::playout(pcg32 &r)
+{
+    Position pos(rootPos);
+    uint32_t path[MAX_PATH];
+    Color movers[MAX_PATH]; // who scores at each node
+    int len = 0;
+
+    uint32_t node = root;
+    pool[node].visits.fetch_add(1, std::memory_order_relaxed);
+    path[len]     = node;
+    movers[len++] = NO_COLOR;
+
+    Color winner = NO_COLOR;
+    bool decided = false;
+    while (len < MAX_PATH) {
+        MctsNode &n = pool[node];
+        if (pos.drawn()) {
+            winner  = NO_COLOR; // no use growing the tree past the end
+            decided = true;
+            break;
+        }
+        if (n.state.load(std::memory_order_acquire) != EXPANDED) {
+            // New nodes wait for a second visit, saves the arena for the good ones
+            bool grow = node == root || n.chance || n.visits.load(std::memory_order_relaxed) > 1;
+            if (!grow || !expand(node, pos)) {
+                break;
+            }
+        }
+        if (n.childCount == 0) {
+            winner  = ~pos.due_up(); // stuck
+            decided = true;
+            break;
+        }
+
+        uint32_t child;
+        Color mover;
+        if (n.chance) {
+            int total = 0;
+            for (int i = 0; i < n.childCount; i += 1) {
+                total += pool[n.firstChild + i].weight;
+            }
+            int k = r(total);
+            child = n.firstChild;
+            while ((k -= pool[child].weight) >= 0) {
+                child += 1;
+            }
+            mover = movers[len - 1];
+            pos.do_move(n.move, pool[child].revealed);
+        } else {
+            // PUCT, with what other threads are still playing out as losses
+            double sqrtN = std::sqrt(double(n.visits.load(std::memory_order_relaxed)));
+            double best  = -1;
+            child        = n.firstChild;
+            for (int i = 0; i < n.childCount; i += 1) {
+                const MctsNode &c = pool[n.firstChild + i];
+                uint32_t visits   = c.visits.load(std::memory_order_relaxed);
+                double q          = visits ? c.score.load(std::memory_order_relaxed) / (2.0 * visits) : 0.5;
+                double u          = q + opt.cpuct * c.prior * sqrtN / (1 + visits);
+                if (u > best) {
+                    best  = u;
+                    child = n.firstChild + i;
+                }
+            }
+            mover = pos.due_up();
+            if (!pool[child].chance) {
+                pos.do_move(pool[child].move, r);
+            }
+        }
+        pool[child].visits.fetch_add(1, std::memory_order_relaxed);
+        node          = child;
+        path[len]     = node;
+        movers[len++] = mover;
+    }
+
+    if (!decided) {
+        if (pool[node].chance) {
+            pos.do_move(pool[node].move, r); // a flip nobody expanded yet
+        }
+        winner = rollout(pos, r, opt.rolloutPlies);
+    }
+    for (int i = 1; i < len; i += 1) {
+        uint32_t points = winner == NO_COLOR ? 1 : winner == movers[i] ? 2 : 0;
+        pool[path[i]].score.fetch_add(points, std::memory_order_relaxed);
+    }
+}
+
+// Moves what is below the root to the front of a new arena
+void MctsTree::compact()
+{
+    std::unique_ptr<MctsNode[]> fresh(new MctsNode[capacity]);
+    std::vector<uint32_t> from = { root }; // old index of every new node
+    fresh[0].copy_from(pool[root]);
+    for (size_t i = 0; i < from.size(); i += 1) {
+        const MctsNode &o = pool[from[i]];
+        if (o.state.load(std::memory_order_relaxed) != EXPANDED || o.childCount == 0) {
+            continue;
+        }
+        uint32_t first = from.size();
+        for (int k = 0; k < o.childCount; k += 1) {
+            fresh[first + k].copy_from(pool[o.firstChild + k]);
+            from.push_back(o.firstChild + k);
+        }
+        fresh[i].firstChild = first;
+    }
+    pool.swap(fresh);
+    used.store(from.size());
+    root = 0;
+}
+
+MctsResult MctsTree::search(const Position &pos)
+{
+    Position start(pos);
+    start.set_rules(FullGame);
+    start.attach_history(nullptr); // playouts copy it on every thread
+    if (!hasRoot || start.key() != rootPos.key() || start.collection().size() != rootPos.collection().size()) {
+        reset(start);
+    } else if (used.load() > capacity / 2) {
+        compact();
+    }
+
+    uint64_t before = pool[root].visits.load();
+    Budget budget(opt.playouts || opt.moveTime ? opt.playouts : DEFAULT_PLAYOUTS, opt.moveTime);
+    std::atomic<uint64_t> done(0);
+    std::atomic<bool> stop(false);
+    unsigned threads = rngs.size();
+    parallel_for(threads, threads, [&](size_t, unsigned worker) {
+        // A copy of its own: next to each other in _rngs_ they share cache lines
+        pcg32 r = rngs[worker];
+        while (!stop.load(std::memory_order_relaxed)) {
+            playout(r);
+            if (budget.expired(done.fetch_add(1, std::memory_order_relaxed) + 1)) {
+                stop = true;
+            }
+        }
+        rngs[worker] = r;
+    });
+
+    MctsResult res;
+    const MctsNode &r = pool[root];
+    res.playouts      = pool[root].visits.load() - before;
+    res.visits        = r.visits.load();
+    res.nodes         = std::min(used.load(), capacity);
+    uint32_t most     = 0;
+    for (int i = 0; r.state.load() == EXPANDED && i < r.childCount; i += 1) {
+        const MctsNode &c = pool[r.firstChild + i];
+        uint32_t visits   = c.visits.load();
+        if (visits > most) {
+            most      = visits;
+            res.best  = c.move;
+            res.value = c.score.load() / (2.0 * visits);
+        }
+    }
+    return res;
+}
+
+void MctsTree::advance(Move played, const Piece &revealed)
+{
+    if (!hasRoot) {
+        return;
+    }
+    Position next(rootPos);
+    bool ok = played.type() == Flipping ? next.do_move(played, revealed) : next.do_move(played);
+    if (!ok) {
+        hasRoot = false;
+        return;
+    }
+
+    // Down to the played move, and for a flip on to what it revealed
+    uint32_t node = NO_NODE;
+    const MctsNode &r = pool[root];
+    for (int i = 0; r.state.load() == EXPANDED && i < r.childCount; i += 1) {
+        if (pool[r.firstChild + i].move == played) {
+            node = r.firstChild + i;
+        }
+    }
+    if (node != NO_NODE && pool[node].chance) {
+        const MctsNode &c = pool[node];
+        uint32_t outcome  = NO_NODE;
+        for (int i = 0; c.state.load() == EXPANDED && i < c.childCount; i += 1) {
+            const Piece &p = pool[c.firstChild + i].revealed;
+            if (p.side == revealed.side && p.type == revealed.type) {
+                outcome = c.firstChild + i;
+            }
+        }
+        node = outcome;
+    }
+
+    if (node == NO_NODE) {
+        reset(next);
+        return;
+    }
+    root    = node;
+    rootPos = next;
+}
@@ -0,0 +1,80 @@
+// Wakasagi: Monte Carlo tree search
+// ----------------------------------
+// The other full-game engine, for positions with a lot left face-down where
+// alpha-beta drowns in chance nodes (see search.h).
+//
+// Every thread walks down the same tree at once: PUCT picks among moves,
+// flips sample what they reveal from the bag, and a random game played out
+// from the leaf scores the walk. Counters are atomics and a thread on its
+// way down counts as a loss for the moves it took (virtual loss), so the
+// others spread out instead of piling onto the same path. Nodes come from
+// one preallocated arena.
+//
+// The tree outlives a search: advance() keeps the part below the move that
+// was played for the next one.
+
+#ifndef MCTS_H
+#define MCTS_H
+
+#include "lib/chess.h"
+#include "lib/types.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+struct MctsOptions {
+    unsigned threads   = 0;    // --threads N, 0 = all cores
+    uint64_t playouts  = 0;    // --playouts N, 0 for none
+    uint64_t moveTime  = 0;    // --movetime MS, 0 for none
+    size_t memoryMB    = 64;   // --mcts-mem MB, the node arena
+    double cpuct       = 1.5;  // --cpuct C, exploration
+    int rolloutPlies   = 200;  // playouts longer than this are draws
+};
+
+struct MctsResult {
+    Move best         = Move(0); // most visited, Move(0) if there is no move
+    double value      = 0.5;     // of _best_ for the side to move, 0 ~ 1
+    uint64_t playouts = 0;       // in this search
+    uint64_t visits   = 0;       // at the root, reused ones included
+    size_t nodes      = 0;       // in use in the arena
+};
+
+// The arena and everything in it, see mcts.cpp
+struct MctsNode;
+
+class MctsTree {
+    private:
+    MctsOptions opt;
+    std::unique_ptr<MctsNode[]> pool;
+    uint32_t capacity;
+    std::atomic<uint32_t> used;
+    uint32_t root;
+    Position rootPos;
+    bool hasRoot = false;
+    std::vector<pcg32> rngs; // one per thread, rng_stream(thread)
+
+    void reset(const Position &pos);
+    uint32_t allocate(uint32_t n);
+    bool expand(uint32_t node, const Position &pos);
+    void playout(pcg32 &r);
+    void compact();
+
+    public:
+    explicit MctsTree(const MctsOptions &opt = MctsOptions());
+    ~MctsTree();
+
+    /*
+     * Searches _pos_ by FullGame rules, reusing the tree if _pos_ is where
+     * it stands (after advance()).
+     */
+    MctsResult search(const Position &pos);
+
+    /*
+     * Follows a move on the board, keeping what was learnt below it.
+     * @param   revealed    What a flip turned up, ignored for other moves
+     */
+    void advance(Move played, const Piece &revealed = Piece());
+};
+
+#endif
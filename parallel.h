@@ -0,0 +1,51 @@
+// Wakasagi: parallel loops
+// ----------------------------------
+// Just enough threading for the tools: hand out loop indices to a few
+// threads. Each index is done exactly once, in no particular order.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+ * @returns How many threads to use when asked for _wanted_ (0 = all cores)
+ */
+inline unsigned thread_count(unsigned wanted = 0)
+{
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    return wanted ? wanted : cores;
+}
+
+/*
+ * Calls body(i, worker) for every i in [0, n).
+ * @param   n       Number of indices
+ * @param   threads Number of threads, see thread_count()
+ * @param   body    Callable as body(size_t i, unsigned worker). Workers are
+ *                  numbered from 0, handy for per-thread scratch space.
+ */
+template<typename Body>
+void parallel_for(size_t n, unsigned threads, Body body)
+{
+    threads = std::max(1u, std::min<unsigned>(threads, std::max<size_t>(n, 1)));
+    std::atomic<size_t> next(0);
+    auto run = [&](unsigned worker) {
+        for (size_t i = next++; i < n; i = next++) {
+            body(i, worker);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < threads; w += 1) {
+        pool.emplace_back(run, w);
+    }
+    run(0);
+    for (std::thread &t : pool) {
+        t.join();
+    }
+}
+
+#endif
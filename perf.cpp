@@ -0,0 +1,112 @@
+// Wakasagi: hardware performance counters
+// ----------------------------------
+
+#include "perf.h"
+
+#include <cstdio>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char *const PERF_NAMES[PERF_EVENT_NB] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+static int open_event(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.inherit        = 1; // the search threads too
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t cache_miss(uint64_t cache)
+{
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+PerfCounters::PerfCounters()
+{
+    for (int e = 0; e < PERF_EVENT_NB; e += 1) {
+        fds[e]    = -1;
+        values[e] = 0;
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+bool PerfCounters::open()
+{
+    fds[PERF_CYCLES]        = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[PERF_INSTRUCTIONS]  = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[PERF_L1D_MISSES]    = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+    fds[PERF_LLC_MISSES]    = open_event(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+    fds[PERF_BRANCH_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+
+    bool any = false;
+    for (int fd : fds) {
+        any = any || fd >= 0;
+    }
+    return any;
+}
+
+void PerfCounters::start()
+{
+    for (int fd : fds) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop()
+{
+    for (int e = 0; e < PERF_EVENT_NB; e += 1) {
+        values[e] = 0;
+        if (fds[e] >= 0) {
+            ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t data[3]; // value, time enabled, time running
+            if (read(fds[e], data, sizeof(data)) == sizeof(data) && data[2] > 0) {
+                values[e] = data[2] < data[1] ? uint64_t(double(data[0]) * data[1] / data[2]) : data[0];
+            }
+        }
+    }
+}
+
+std::string PerfCounters::json(uint64_t work) const
+{
+    char buf[128];
+    std::string s = "{";
+    for (int e = 0; e < PERF_EVENT_NB; e += 1) {
+        if (available(PerfEvent(e))) {
+            snprintf(buf, sizeof(buf), "\"%s\":%llu,\"%s_per_node\":%.3f,", PERF_NAMES[e],
+                     (unsigned long long)values[e], PERF_NAMES[e], work ? (double)values[e] / work : 0.0);
+        } else {
+            snprintf(buf, sizeof(buf), "\"%s\":null,\"%s_per_node\":null,", PERF_NAMES[e], PERF_NAMES[e]);
+        }
+        s += buf;
+    }
+    if (available(PERF_CYCLES) && available(PERF_INSTRUCTIONS) && values[PERF_CYCLES]) {
+        snprintf(buf, sizeof(buf), "\"ipc\":%.3f}", (double)values[PERF_INSTRUCTIONS] / values[PERF_CYCLES]);
+    } else {
+        snprintf(buf, sizeof(buf), "\"ipc\":null}");
+    }
+    return s + buf;
+}
@@ -0,0 +1,66 @@
+// Wakasagi: hardware performance counters
+// ----------------------------------
+// Cycles, instructions, cache and branch misses from perf_event_open(2),
+// for the benchmarks. Counters the kernel won't give us (no PMU in a VM,
+// perf_event_paranoid too high) are simply missing from the report.
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_EVENT_NB
+};
+
+class PerfCounters {
+    public:
+    using Values = std::array<uint64_t, PERF_EVENT_NB>;
+
+    private:
+    int fds[PERF_EVENT_NB];
+    Values values;
+
+    public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    /*
+     * Opens every counter it can, for this thread and the threads it starts
+     * from then on, user space only.
+     * @returns false if none could be opened
+     */
+    bool open();
+
+    bool available(PerfEvent e) const { return fds[e] >= 0; }
+
+    // Zeroes and starts the counters
+    void start();
+
+    // Stops them and reads the values. A counter that had to share the PMU
+    // with others is scaled up to the whole time it was enabled.
+    void stop();
+
+    uint64_t value(PerfEvent e) const { return values[e]; }
+
+    // For reporting an earlier start()/stop() than the last one
+    const Values &snapshot() const { return values; }
+    void restore(const Values &v) { values = v; }
+
+    /*
+     * The last start()/stop() as a JSON object, with IPC and every count
+     * divided by _work_ (search nodes, perft leaves, microbenchmark calls). Missing counters are null.
+     */
+    std::string json(uint64_t work) const;
+};
+
+#endif
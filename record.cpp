@@ -0,0 +1,198 @@
+// Wakasagi: binary position records
+// ----------------------------------
+
+#include "record.h"
+#include "lib/cdc.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr uint64_t RECORD_MAGIC = 0x31534F5047534B57ULL; // "WKSGPOS1"
+
+static_assert(sizeof(PositionRecord) == 24, "position records must stay 24 bytes");
+static_assert(sizeof(RecordHeader) == 16, "record header must stay 16 bytes");
+
+// Bag radix of each piece type: one more than the standard set has
+constexpr int BAG_RADIX[MOVABLE_PIECE_TYPE_NB] = { 2, 3, 3, 3, 3, 3, 6 };
+
+static int nibble(Piece p)
+{
+    if (p.side == Mystery) {
+        return 1;
+    }
+    if (p.type == NO_PIECE) {
+        return 0;
+    }
+    return (p.side == Red ? 9 : 2) + (p.type == Duck ? 0 : p.type);
+}
+
+bool pack_record(const Position &pos, PositionRecord &rec)
+{
+    memset(&rec, 0, sizeof(rec));
+    for (Square sq : BoardView(pos.pieces())) {
+        rec.board[sq / 2] |= nibble(pos.peek_piece_at(sq)) << (4 * (sq % 2));
+    }
+    rec.ducks = pos.pieces(Duck);
+
+    uint32_t bag = 0;
+    for (Color c : { Red, Black }) {
+        for (int pt = Soldier; pt >= General; pt -= 1) {
+            int n = pos.collection_count(Piece(c, PieceType(pt)));
+            if (n >= BAG_RADIX[pt]) {
+                return false;
+            }
+            bag = bag * BAG_RADIX[pt] + n;
+        }
+    }
+    rec.bag[0] = bag;
+    rec.bag[1] = bag >> 8;
+    rec.bag[2] = bag >> 16;
+
+    rec.flags = (pos.due_up() == Red) | (std::min(pos.fifty_move_count(), 127) << 1);
+    return true;
+}
+
+static Piece piece_of(const PositionRecord &rec, Square sq)
+{
+    int code = (rec.board[sq / 2] >> (4 * (sq % 2))) & 0xF;
+    if (code == 0) {
+        return Piece();
+    }
+    if (code == 1) {
+        return Piece(Mystery, Hidden);
+    }
+    Color side = code >= 9 ? Red : Black;
+    return Piece(side, (rec.ducks >> sq) & 1 ? Duck : PieceType(code - (side == Red ? 9 : 2)));
+}
+
+void unpack_record(const PositionRecord &rec, Position &pos)
+{
+    pos.clear();
+    for (Square sq = SQ_A1; sq < SQUARE_NB; sq += 1) {
+        Piece p = piece_of(rec, sq);
+        if (p.type != NO_PIECE) {
+            pos.place_piece_at(p, sq);
+        }
+    }
+    pos.set_side_to_move(rec.flags & 1 ? Red : Black);
+    pos.set_fifty_move_count(rec.flags >> 1);
+
+    // Undo the mixed radix, black first
+    uint32_t bag = rec.bag[0] | (rec.bag[1] << 8) | (rec.bag[2] << 16);
+    Piece set[32];
+    size_t n = 0;
+    for (Color c : { Black, Red }) {
+        for (int pt = General; pt <= Soldier; pt += 1) {
+            for (int k = bag % BAG_RADIX[pt]; k > 0; k -= 1) {
+                set[n++] = Piece(c, PieceType(pt));
+            }
+            bag /= BAG_RADIX[pt];
+        }
+    }
+    pos.clear_collection();
+    pos.add_collection(set, n);
+}
+
+bool fen_to_record(std::string_view fen, PositionRecord &rec)
+{
+    // FENs don't carry the bag, so it gets the standard set like Position(fen)
+    Position pos;
+    if (!pos.readFEN(fen)) {
+        return false;
+    }
+    pos.clear_collection();
+    pos.add_collection();
+    return pack_record(pos, rec);
+}
+
+size_t record_to_fen(const PositionRecord &rec, char *buf)
+{
+    Position pos;
+    unpack_record(rec, pos);
+    return pos.toFEN(buf);
+}
+
+bool RecordWriter::open(const std::string &path)
+{
+    close();
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        error << "Can't create \"" << path << "\"\n";
+        return false;
+    }
+    RecordHeader h = { RECORD_MAGIC, sizeof(PositionRecord), 0 };
+    return fwrite(&h, sizeof(h), 1, file) == 1;
+}
+
+bool RecordWriter::write(const PositionRecord &rec)
+{
+    return file && fwrite(&rec, sizeof(rec), 1, file) == 1;
+}
+
+bool RecordWriter::close()
+{
+    if (!file) {
+        return true;
+    }
+    bool ok = fclose(file) == 0;
+    file    = nullptr;
+    return ok;
+}
+
+bool RecordReader::is_record_file(const std::string &path)
+{
+    RecordHeader h;
+    FILE *f = fopen(path.c_str(), "rb");
+    bool ok = f && fread(&h, sizeof(h), 1, f) == 1 && h.magic == RECORD_MAGIC;
+    if (f) {
+        fclose(f);
+    }
+    return ok;
+}
+
+bool RecordReader::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(RecordHeader)) {
+        error << "Can't read records from \"" << path << "\"\n";
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    size = st.st_size;
+    map  = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        error << "Can't map \"" << path << "\"\n";
+        return false;
+    }
+
+    const RecordHeader *h = static_cast<const RecordHeader *>(map);
+    if (h->magic != RECORD_MAGIC || h->recordSize != sizeof(PositionRecord)) {
+        error << "\"" << path << "\" is not a position record file\n";
+        close();
+        return false;
+    }
+    first = reinterpret_cast<const PositionRecord *>(h + 1);
+    count = (size - sizeof(RecordHeader)) / sizeof(PositionRecord);
+    madvise(map, size, MADV_SEQUENTIAL);
+    return true;
+}
+
+void RecordReader::close()
+{
+    if (map) {
+        munmap(map, size);
+    }
+    map   = nullptr;
+    size  = 0;
+    first = nullptr;
+    count = 0;
+}
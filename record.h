@@ -0,0 +1,115 @@
+// Wakasagi: binary position records
+// ----------------------------------
+// Positions in 24 bytes each, for corpora and logs too big for FEN text.
+// A record file is a 16-byte header followed by records back to back, so
+// a reader can map the file and use the records where they lie.
+//
+// Record layout:
+//   board   16 bytes, one nibble per square (square 0 in the low nibble):
+//             0       empty
+//             1       face-down
+//             2 ~ 8   black General ~ Soldier
+//             9 ~ 15  red General ~ Soldier
+//   ducks   4 bytes, a Board of ducks; their nibble only tells the side
+//   bag     3 bytes, how many of each piece are left in the bag, mixed radix
+//           (General 0~1, Soldier 0~5, the others 0~2, black then red)
+//   flags   1 byte, red to play in bit 0, fifty-move counter in bits 1~7
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include "lib/chess.h"
+#include "lib/types.h"
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+struct PositionRecord {
+    uint8_t board[16];
+    uint32_t ducks;
+    uint8_t bag[3];
+    uint8_t flags;
+};
+
+struct RecordHeader {
+    uint64_t magic;
+    uint32_t recordSize;
+    uint32_t unused;
+};
+
+/*
+ * @param   pos Fifty-move counters above 127 are stored as 127
+ * @returns false if the bag holds more of a piece than the standard set,
+ *          which the record has no room for
+ */
+bool pack_record(const Position &pos, PositionRecord &rec);
+
+/*
+ * Sets up _pos_ from scratch, bag included.
+ */
+void unpack_record(const PositionRecord &rec, Position &pos);
+
+/*
+ * FEN <-> record, by way of a Position. The FEN gets the standard bag, as
+ * with Position(fen).
+ * @returns false / 0 if the FEN is malformed
+ */
+bool fen_to_record(std::string_view fen, PositionRecord &rec);
+size_t record_to_fen(const PositionRecord &rec, char *buf); // FEN_BUFFER_SIZE
+
+/*
+ * Appends records to a new file, buffered.
+ */
+class RecordWriter {
+    private:
+    FILE *file = nullptr;
+
+    public:
+    ~RecordWriter() { close(); }
+
+    /*
+     * Creates (or truncates) _path_ and writes the header.
+     */
+    bool open(const std::string &path);
+    bool write(const PositionRecord &rec);
+    /*
+     * @returns false if anything failed to reach the disk
+     */
+    bool close();
+};
+
+/*
+ * Maps a record file read-only and hands out its records in place.
+ */
+class RecordReader {
+    private:
+    void *map   = nullptr;
+    size_t size = 0;
+    const PositionRecord *first = nullptr;
+    size_t count = 0;
+
+    public:
+    RecordReader() = default;
+    RecordReader(const RecordReader &) = delete;
+    RecordReader &operator=(const RecordReader &) = delete;
+    ~RecordReader() { close(); }
+
+    /*
+     * @returns false if _path_ can't be read or is not a record file
+     */
+    bool open(const std::string &path);
+    void close();
+
+    /*
+     * @returns Whether _path_ starts like a record file, without mapping it
+     */
+    static bool is_record_file(const std::string &path);
+
+    const PositionRecord *begin() const { return first; }
+    const PositionRecord *end() const { return first + count; }
+    size_t records() const { return count; }
+    const PositionRecord &operator[](size_t i) const { return first[i]; }
+};
+
+#endif
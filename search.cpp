@@ -0,0 +1,835 @@
+// Wakasagi: game search
+// ----------------------------------
+
+#include "search.h"
+#include "parallel.h"
+#include "solver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+constexpr int ASPIRATION_DELTA = 40;
+
+// About as far as evaluate() goes, one side's whole set. Chance nodes
+// count a won or lost game as this much, so Star1 gets tight bounds.
+constexpr int OUTCOME_BOUND = 2500;
+
+// pimc_search() trusts how much the deals disagree from this many on, and
+// calls the best move settled at this many standard errors ahead (99%)
+constexpr size_t PIMC_MIN_SAMPLES = 8;
+constexpr double PIMC_SETTLED_Z   = 2.33;
+
+// Squares the face-up pieces of _c_ can move to or capture on, weighted
+static int mobility(const Position &pos, Color c)
+{
+    Board occupied = pos.pieces();
+    Board own      = pos.pieces(c);
+    int score      = 0;
+    for (Square sq : BoardView(own & ~pos.pieces(Duck))) {
+        PieceType pt = pos.peek_piece_at(sq).type;
+        score += MOBILITY_WEIGHT[pt] * __builtin_popcount(attacks_bb(pt, sq, occupied) & ~own);
+    }
+    return score;
+}
+
+int evaluate(const Position &pos)
+{
+    // Material and squares are kept up to date by the position
+    int score = pos.psq_score();
+
+    // Every face-down piece is what the bag holds on average
+    const PieceBag &bag = pos.collection();
+    if (!bag.empty()) {
+        int hidden = __builtin_popcount(pos.pieces(Hidden));
+        score += hidden * bag.worth() * HIDDEN_PERCENT / (100 * bag.size());
+    }
+
+    score += mobility(pos, Black) - mobility(pos, Red);
+    return pos.due_up() == Black ? score : -score;
+}
+
+// -~ Transposition table ~-
+
+enum Bound : uint8_t { BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT };
+
+struct TTEntry {
+    uint32_t check; // upper half of the key
+    Move move;
+    int16_t score;
+    int8_t depth;
+    uint8_t bound;
+};
+
+class TranspositionTable {
+    private:
+    std::unique_ptr<TTEntry[]> entries;
+    size_t mask;
+
+    public:
+    explicit TranspositionTable(size_t mb)
+    {
+        size_t n = 1;
+        while (2 * n * sizeof(TTEntry) <= std::max<size_t>(mb, 1) << 20) {
+            n <<= 1;
+        }
+        entries.reset(new TTEntry[n]());
+        mask = n - 1;
+    }
+
+    TTEntry *probe(Key key, bool &found) const
+    {
+        TTEntry *e = &entries[key & mask];
+        found      = e->bound != BOUND_NONE && e->check == uint32_t(key >> 32);
+        return e;
+    }
+
+    // Keeps the deeper entry of the same position, otherwise replaces
+    void store(Key key, Move mv, int score, int depth, Bound bound)
+    {
+        TTEntry *e     = &entries[key & mask];
+        uint32_t check = key >> 32;
+        if (e->check == check && e->depth > depth && bound != BOUND_EXACT) {
+            return;
+        }
+        if (mv == Move(0) && e->check == check) {
+            mv = e->move;
+        }
+        *e = { check, mv, int16_t(score), int8_t(depth), uint8_t(bound) };
+    }
+};
+
+// For threads searching at once. A slot holds the key xor'ed with the data,
+// so a slot caught halfway through a write reads as a miss (Hyatt).
+class SharedTable {
+    private:
+    struct Slot {
+        std::atomic<uint64_t> check;
+        std::atomic<uint64_t> data; // move, score, depth, bound from the low bits up
+    };
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+    public:
+    explicit SharedTable(size_t mb)
+    {
+        size_t n = 1;
+        while (2 * n * sizeof(Slot) <= std::max<size_t>(mb, 1) << 20) {
+            n <<= 1;
+        }
+        slots.reset(new Slot[n]());
+        mask = n - 1;
+    }
+
+    bool probe(Key key, TTEntry &e) const
+    {
+        const Slot &s = slots[key & mask];
+        uint64_t data = s.data.load(std::memory_order_relaxed);
+        if ((s.check.load(std::memory_order_relaxed) ^ data) != key || (data >> 40) == BOUND_NONE) {
+            return false;
+        }
+        e = { uint32_t(key >> 32), Move(uint16_t(data)), int16_t(data >> 16), int8_t(data >> 32), uint8_t(data >> 40) };
+        return true;
+    }
+
+    // Same replacement as TranspositionTable
+    void store(Key key, Move mv, int score, int depth, Bound bound)
+    {
+        TTEntry old;
+        if (probe(key, old)) {
+            if (old.depth > depth && bound != BOUND_EXACT) {
+                return;
+            }
+            if (mv == Move(0)) {
+                mv = old.move;
+            }
+        }
+        uint64_t data = uint64_t(uint16_t(mv)) | uint64_t(uint16_t(score)) << 16 | uint64_t(uint8_t(depth)) << 32 |
+                        uint64_t(bound) << 40;
+        Slot &s = slots[key & mask];
+        s.check.store(key ^ data, std::memory_order_relaxed);
+        s.data.store(data, std::memory_order_relaxed);
+    }
+};
+
+// Mate scores are stored relative to the node, not the root
+static int score_to_tt(int score, int ply)
+{
+    return score > MATE_BOUND ? score + ply : score < -MATE_BOUND ? score - ply : score;
+}
+
+static int score_from_tt(int score, int ply)
+{
+    return score > MATE_BOUND ? score - ply : score < -MATE_BOUND ? score + ply : score;
+}
+
+// -~ Chance nodes ~-
+
+// What a flip can turn up, weighted by how many of each are in the bag
+struct Outcomes {
+    Piece piece[2 * MOVABLE_PIECE_TYPE_NB];
+    int weight[2 * MOVABLE_PIECE_TYPE_NB];
+    int n;
+    int total;
+};
+
+static void flip_outcomes(const Position &pos, Outcomes &o)
+{
+    o.n = o.total = 0;
+    for (Color c : { Black, Red }) {
+        for (int pt = General; pt <= Soldier; pt += 1) {
+            Piece p(c, PieceType(pt));
+            int k = pos.collection_count(p);
+            if (k > 0) {
+                o.piece[o.n]    = p;
+                o.weight[o.n++] = k;
+                o.total += k;
+            }
+        }
+    }
+    if (o.total == 0) {
+        // An empty bag reveals anything, evenly (random_faceup_piece())
+        for (Color c : { Black, Red }) {
+            for (int pt = General; pt <= Soldier; pt += 1) {
+                o.piece[o.n]    = Piece(c, PieceType(pt));
+                o.weight[o.n++] = 1;
+            }
+        }
+        o.total = o.n;
+    }
+}
+
+// -~ Search ~-
+
+struct Searcher {
+    TranspositionTable tt;
+    Budget budget;
+    bool star;
+    uint64_t nodes = 0;
+    bool stopped   = false;
+    ChanceStats chances;
+
+    // pimc_search(): what every face-down piece was dealt, so flips are
+    // plain moves, and a salt that keeps one deal's entries out of the next
+    // one's in _tt_. Positions with nothing face-down go to _shared_.
+    const Piece *dealt             = nullptr;
+    Key salt                       = 0;
+    SharedTable *shared            = nullptr;
+    const std::atomic<bool> *halt  = nullptr; // stops the search when set
+
+    Key keys[KEY_HISTORY_SIZE]; // the game so far and the line searched, for repetitions
+    Move killers[MAX_PLY][2];
+    int history[SIDE_NB][SQUARE_NB][SQUARE_NB];
+    Move pv[MAX_PLY][MAX_PLY];
+    int pvLength[MAX_PLY];
+
+    Searcher(const SearchOptions &opt)
+      : tt(opt.hashMB)
+      , budget(opt.nodeLimit, opt.moveTime)
+      , star(opt.star)
+    {
+        memset(killers, 0, sizeof(killers));
+        memset(history, 0, sizeof(history));
+    }
+
+    bool out_of_budget()
+    {
+        nodes += 1;
+        stopped = stopped || budget.expired(nodes) || (halt && halt->load(std::memory_order_relaxed));
+        return stopped;
+    }
+
+    bool tt_probe(const Position &pos, TTEntry &e) const
+    {
+        if (shared && !pos.pieces(Hidden)) {
+            return shared->probe(pos.key(), e);
+        }
+        bool found;
+        e = *tt.probe(pos.key() ^ salt, found);
+        return found;
+    }
+
+    void tt_store(const Position &pos, Move mv, int score, int depth, Bound bound)
+    {
+        if (shared && !pos.pieces(Hidden)) {
+            shared->store(pos.key(), mv, score, depth, bound);
+        } else {
+            tt.store(pos.key() ^ salt, mv, score, depth, bound);
+        }
+    }
+
+    int qsearch(const Position &pos, int alpha, int beta, int ply);
+    int pvs(const Position &pos, int alpha, int beta, int depth, int ply);
+    int probe(const Position &pos, int bound, int depth, int ply);
+    int chance(const Position &pos, Move flip, const Outcomes &o, int alpha, int beta, int depth, int ply);
+};
+
+static bool is_capture(const Position &pos, Move mv)
+{
+    return mv.type() == Moving && pos.peek_piece_at(mv.to()).type != NO_PIECE;
+}
+
+// Puts the best scoring move from _i_ on at _i_, a selection sort step
+static void pick(Move *moves, int *scores, int i, int n)
+{
+    int best = i;
+    for (int j = i + 1; j < n; j += 1) {
+        if (scores[j] > scores[best]) {
+            best = j;
+        }
+    }
+    std::swap(moves[i], moves[best]);
+    std::swap(scores[i], scores[best]);
+}
+
+int Searcher::qsearch(const Position &pos, int alpha, int beta, int ply)
+{
+    if (out_of_budget()) {
+        return 0;
+    }
+    int standPat = evaluate(pos);
+    if (standPat >= beta || ply >= MAX_PLY - 1) {
+        return standPat;
+    }
+    alpha = std::max(alpha, standPat);
+
+    MoveList<Moving> moves(pos);
+    Move caps[MAX_MOVES];
+    int scores[MAX_MOVES];
+    int n = 0;
+    for (Move mv : moves) {
+        if (is_capture(pos, mv)) {
+            caps[n]     = mv;
+            scores[n++] = 16 * PIECE_VALUE[pos.peek_piece_at(mv.to()).type] - pos.peek_piece_at(mv.from()).type;
+        }
+    }
+
+    for (int i = 0; i < n; i += 1) {
+        pick(caps, scores, i, n);
+        Position next(pos);
+        if (!next.do_move(caps[i])) {
+            continue;
+        }
+        int score = -qsearch(next, -beta, -alpha, ply + 1);
+        if (stopped) {
+            return 0;
+        }
+        if (score >= beta) {
+            return score;
+        }
+        alpha = std::max(alpha, score);
+    }
+    return alpha;
+}
+
+int Searcher::pvs(const Position &pos, int alpha, int beta, int depth, int ply)
+{
+    pvLength[ply] = ply;
+    if (ply > 0 && (pos.repetitions() > 0 || pos.fifty_move_count() >= FIFTY_MOVE_PLIES)) {
+        return 0; // once around is enough to call it a draw
+    }
+    if (depth <= 0) {
+        return qsearch(pos, alpha, beta, ply);
+    }
+    if (out_of_budget()) {
+        return 0;
+    }
+    if (ply >= MAX_PLY - 1) {
+        return evaluate(pos);
+    }
+
+    bool pvNode = beta - alpha > 1;
+    TTEntry tte;
+    bool found  = tt_probe(pos, tte);
+    Move ttMove = found ? tte.move : Move(0);
+    if (found && !pvNode && tte.depth >= depth) {
+        int s = score_from_tt(tte.score, ply);
+        if (tte.bound == BOUND_EXACT || (tte.bound == BOUND_LOWER && s >= beta) ||
+            (tte.bound == BOUND_UPPER && s <= alpha)) {
+            return s;
+        }
+    }
+
+    // Nothing to play loses, as winner() says. Running out of pieces ends
+    // up here too: the last capture leaves the other side without a move.
+    MoveList moves(pos);
+    Move *list = moves.begin();
+    int n      = moves.size();
+    if (n == 0) {
+        return -MATE + ply;
+    }
+
+    // Order the moves, see search.h
+    int scores[MAX_MOVES];
+    Color us = pos.due_up();
+    for (int i = 0; i < n; i += 1) {
+        Move mv = list[i];
+        if (mv == ttMove) {
+            scores[i] = 1 << 30;
+        } else if (mv.type() == Flipping) {
+            scores[i] = -(1 << 30);
+        } else if (is_capture(pos, mv)) {
+            scores[i] = (1 << 24) + 16 * PIECE_VALUE[pos.peek_piece_at(mv.to()).type] - pos.peek_piece_at(mv.from()).type;
+        } else if (mv == killers[ply][0]) {
+            scores[i] = 1 << 23;
+        } else if (mv == killers[ply][1]) {
+            scores[i] = (1 << 23) - 1;
+        } else {
+            scores[i] = history[us][mv.from()][mv.to()];
+        }
+    }
+
+    int alphaOrig = alpha;
+    int bestScore = -MATE;
+    Move bestMove = Move(0);
+    int moveCount = 0;
+    Outcomes outcomes;
+    outcomes.n = -1; // worked out at the first flip, the same for all of them
+    for (int i = 0; i < n; i += 1) {
+        pick(list, scores, i, n);
+        Move mv = list[i];
+
+        int score;
+        bool quiet = !is_capture(pos, mv);
+        if (mv.type() == Flipping && !dealt) {
+            if (outcomes.n < 0) {
+                flip_outcomes(pos, outcomes);
+            }
+            moveCount += 1;
+            quiet = false;
+            if (moveCount == 1) {
+                score = chance(pos, mv, outcomes, alpha, beta, depth, ply);
+            } else {
+                // Reduced like a late quiet move, there are a lot of them
+                int r = depth >= 3 && moveCount > 3 ? 1 : 0;
+                score = chance(pos, mv, outcomes, alpha, alpha + 1, depth - r, ply);
+                if (score > alpha && r > 0) {
+                    score = chance(pos, mv, outcomes, alpha, alpha + 1, depth, ply);
+                }
+                if (score > alpha && score < beta) {
+                    score = chance(pos, mv, outcomes, alpha, beta, depth, ply);
+                }
+            }
+        } else {
+            Position next(pos);
+            bool legal = mv.type() == Flipping ? next.do_move(mv, dealt[mv.from()]) : next.do_move(mv);
+            if (!legal) {
+                continue;
+            }
+            moveCount += 1;
+
+            if (moveCount == 1) {
+                score = -pvs(next, -beta, -alpha, depth - 1, ply + 1);
+            } else {
+                // Late quiet moves get a shallower look first
+                int r = 0;
+                if (depth >= 3 && moveCount > 3 && quiet && mv != killers[ply][0] && mv != killers[ply][1]) {
+                    r = std::min(depth - 2, moveCount > 8 ? 2 : 1);
+                }
+                score = -pvs(next, -alpha - 1, -alpha, depth - 1 - r, ply + 1);
+                if (score > alpha && r > 0) {
+                    score = -pvs(next, -alpha - 1, -alpha, depth - 1, ply + 1);
+                }
+                if (score > alpha && score < beta) {
+                    score = -pvs(next, -beta, -alpha, depth - 1, ply + 1);
+                }
+            }
+        }
+        if (stopped) {
+            return 0;
+        }
+
+        if (score > bestScore) {
+            bestScore = score;
+            bestMove  = mv;
+        }
+        if (score > alpha) {
+            alpha        = score;
+            pv[ply][ply] = mv;
+            for (int j = ply + 1; j < pvLength[ply + 1]; j += 1) {
+                pv[ply][j] = pv[ply + 1][j];
+            }
+            pvLength[ply] = mv.type() == Flipping ? ply + 1 : pvLength[ply + 1];
+        }
+        if (alpha >= beta) {
+            if (quiet) {
+                if (killers[ply][0] != mv) {
+                    killers[ply][1] = killers[ply][0];
+                    killers[ply][0] = mv;
+                }
+                history[us][mv.from()][mv.to()] += depth * depth;
+            }
+            break;
+        }
+    }
+
+    if (moveCount == 0) {
+        return evaluate(pos);
+    }
+    Bound bound = bestScore >= beta ? BOUND_LOWER : bestScore > alphaOrig ? BOUND_EXACT : BOUND_UPPER;
+    tt_store(pos, bestMove, score_to_tt(bestScore, ply), depth, bound);
+    return bestScore;
+}
+
+// The score of _pos_ from its most promising move alone, searched with the
+// null window that tells whether it reaches _bound_. Only a lower bound on
+// _pos_ when it does: short of _bound_ it bounds that move, not _pos_
+int Searcher::probe(const Position &pos, int bound, int depth, int ply)
+{
+    MoveList moves(pos);
+    if (moves.size() == 0) {
+        return -MATE + ply;
+    }
+
+    TTEntry tte;
+    bool found   = tt_probe(pos, tte);
+    Move best    = Move(0);
+    int bestGain = -1;
+    for (Move mv : moves) {
+        if (mv.type() == Flipping) {
+            continue; // a chance node of its own, too dear for a probe
+        }
+        if (found && mv == tte.move) {
+            best = mv;
+            break;
+        }
+        int gain = is_capture(pos, mv) ? PIECE_VALUE[pos.peek_piece_at(mv.to()).type] : 0;
+        if (gain > bestGain) {
+            best     = mv;
+            bestGain = gain;
+        }
+    }
+    Position next(pos);
+    if (best == Move(0) || !next.do_move(best)) {
+        return -MATE;
+    }
+    return -pvs(next, -bound, -bound + 1, depth - 1, ply + 1);
+}
+
+// The expected score of _flip_ over its outcomes, each clamped to
+// +-OUTCOME_BOUND. Star2 first bounds every outcome from above with a
+// probe, which is often enough to show the flip can't beat alpha. Star1
+// then searches the outcomes one by one, each with the window in which it
+// can still move the expectation across alpha or beta, and stops as soon
+// as it can't. Fail-soft, like pvs().
+int Searcher::chance(const Position &pos, Move flip, const Outcomes &o, int alpha, int beta, int depth, int ply)
+{
+    constexpr int L = -OUTCOME_BOUND;
+    constexpr int U = OUTCOME_BOUND;
+    auto clamp      = [](int v) { return std::min(OUTCOME_BOUND, std::max(-OUTCOME_BOUND, v)); };
+
+    chances.nodes += 1;
+    const int64_t total = o.total;
+    int upper[2 * MOVABLE_PIECE_TYPE_NB];
+    int64_t sumUpper = total * U;
+    for (int j = 0; j < o.n; j += 1) {
+        upper[j] = U;
+    }
+
+    if (star && depth >= 2) {
+        for (int j = 0; j < o.n; j += 1) {
+            // Small enough for this one to give the fail low by itself
+            int64_t rest = sumUpper - o.weight[j] * int64_t(U);
+            int target   = clamp(int(std::floor(double(int64_t(alpha) * total - rest) / o.weight[j])));
+
+            Position next(pos);
+            if (!next.do_move(flip, o.piece[j])) {
+                return evaluate(pos);
+            }
+            // The reply's fail-soft score bounds this outcome from above only
+            // when the reply failed low; when it failed high it is a lower
+            // bound on the reply, and says nothing about how good this is
+            int reply = -probe(next, -target, depth - 1, ply + 1);
+            if (stopped) {
+                return 0;
+            }
+            upper[j] = reply <= target ? clamp(reply) : U;
+            sumUpper -= o.weight[j] * int64_t(U - upper[j]);
+            if (sumUpper <= int64_t(alpha) * total) {
+                chances.star2Cuts += 1;
+                return sumUpper / total;
+            }
+        }
+    }
+
+    int64_t sum       = 0; // weighted scores of the outcomes searched
+    int64_t restUpper = sumUpper;
+    int64_t restLower = total * L;
+    for (int j = 0; j < o.n; j += 1) {
+        int64_t w = o.weight[j];
+        restUpper -= w * upper[j];
+        restLower -= w * L;
+
+        // The expectation beats alpha only if this one beats lo, and
+        // reaches beta for sure once this one reaches hi
+        double lo = star ? double(int64_t(alpha) * total - sum - restUpper) / w : L - 1;
+        double hi = star ? double(int64_t(beta) * total - sum - restLower) / w : U + 1;
+        if (upper[j] <= lo) {
+            chances.star1Cuts += 1;
+            return (sum + w * upper[j] + restUpper) / total;
+        }
+        if (hi <= L) {
+            chances.star1Cuts += 1;
+            return (sum + w * L + restLower) / total;
+        }
+
+        Position next(pos);
+        if (!next.do_move(flip, o.piece[j])) {
+            return evaluate(pos);
+        }
+        int a = int(std::max<double>(std::floor(lo), L - 1));
+        int b = int(std::min<double>(std::ceil(hi), U + 1));
+        int v = clamp(-pvs(next, -b, -a, depth - 1, ply + 1));
+        if (stopped) {
+            return 0;
+        }
+        if (v >= hi) {
+            chances.star1Cuts += 1;
+            return (sum + w * v + restLower) / total;
+        }
+        if (v <= lo) {
+            chances.star1Cuts += 1;
+            return (sum + w * v + restUpper) / total;
+        }
+        sum += w * v;
+    }
+    return sum / total;
+}
+
+SearchResult search(const Position &pos, const SearchOptions &opt)
+{
+    SearchResult res;
+
+    Position root(pos);
+    root.set_rules(FullGame);
+
+    std::unique_ptr<Searcher> s(new Searcher(opt));
+    root.attach_history(s->keys);
+    int score = 0;
+    for (int depth = 1; depth <= std::min(opt.depth, MAX_PLY - 1); depth += 1) {
+        // Aspiration window around the last score, widened on a miss
+        int delta = ASPIRATION_DELTA;
+        int alpha = depth >= 4 ? std::max(score - delta, -MATE) : -MATE;
+        int beta  = depth >= 4 ? std::min(score + delta, MATE) : MATE;
+        while (true) {
+            int v = s->pvs(root, alpha, beta, depth, 0);
+            if (s->stopped) {
+                break;
+            }
+            if (v <= alpha && alpha > -MATE) {
+                alpha = std::max(v - delta, -MATE);
+            } else if (v >= beta && beta < MATE) {
+                beta = std::min(v + delta, MATE);
+            } else {
+                score = v;
+                break;
+            }
+            delta *= 2;
+        }
+        if (s->stopped) {
+            break;
+        }
+
+        res.score = score;
+        res.depth = depth;
+        res.pv.assign(s->pv[0], s->pv[0] + s->pvLength[0]);
+        res.best = res.pv.empty() ? Move(0) : res.pv[0];
+        if (std::abs(score) > MATE_BOUND && MATE - std::abs(score) <= depth) {
+            break; // the game ends within the horizon, deeper won't change it
+        }
+    }
+    res.nodes   = s->nodes;
+    res.chances = s->chances;
+
+    // Out of budget before the first iteration was done: anything legal
+    if (res.best == Move(0)) {
+        for (Move mv : MoveList(root)) {
+            Position next(root);
+            if (next.do_move(mv)) {
+                res.best = mv;
+                res.pv   = { mv };
+                break;
+            }
+        }
+    }
+    return res;
+}
+
+// -~ Determinized search ~-
+
+// Who every face-down piece of _pos_ is in one deal, drawn out of the bag
+static void deal(const Position &pos, pcg32 &r, Piece dealt[SQUARE_NB])
+{
+    PieceBag bag = pos.collection();
+    for (Square sq : BoardView(pos.pieces(Hidden))) {
+        dealt[sq] = bag.empty() ? random_faceup_piece(r) : bag.sample(r);
+        bag.take(dealt[sq]);
+    }
+}
+
+// Every root move's score in the deal _s.dealt_, deepened one ply at a time.
+// Keeps the last iteration that finished.
+// @returns Its depth, 0 if none did
+static int score_deal(Searcher &s, const Position &root, const Move *moves, int n, int depth, int *scores)
+{
+    int done = 0;
+    int iter[MAX_MOVES];
+    for (int d = 1; d <= std::min(depth, MAX_PLY - 1); d += 1) {
+        bool decided = true;
+        for (int i = 0; i < n; i += 1) {
+            Position next(root);
+            Move mv = moves[i];
+            if (mv.type() == Flipping) {
+                next.do_move(mv, s.dealt[mv.from()]);
+            } else {
+                next.do_move(mv);
+            }
+            iter[i] = -s.pvs(next, -MATE, MATE, d - 1, 1);
+            if (s.stopped) {
+                return done;
+            }
+            decided = decided && std::abs(iter[i]) > MATE_BOUND;
+        }
+        std::copy(iter, iter + n, scores);
+        done = d;
+        if (decided) {
+            break; // every move wins or loses by force
+        }
+    }
+    return done;
+}
+
+// The move with the best average over the deals so far, and whether each
+// other move trails it by more than PIMC_SETTLED_Z standard errors, taking
+// the difference deal by deal
+static bool settled_best(const std::vector<std::vector<int>> &deals, int n, int &best)
+{
+    size_t k = deals.size();
+    std::vector<double> mean(n, 0.0);
+    for (const std::vector<int> &d : deals) {
+        for (int i = 0; i < n; i += 1) {
+            mean[i] += double(d[i]) / k;
+        }
+    }
+    best = std::max_element(mean.begin(), mean.end()) - mean.begin();
+    if (k < PIMC_MIN_SAMPLES) {
+        return false;
+    }
+
+    for (int i = 0; i < n; i += 1) {
+        if (i == best) {
+            continue;
+        }
+        double gap = mean[best] - mean[i];
+        double var = 0;
+        for (const std::vector<int> &d : deals) {
+            double x = d[best] - d[i] - gap;
+            var += x * x;
+        }
+        var /= k - 1;
+        if (gap <= PIMC_SETTLED_Z * std::sqrt(var / k)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SearchResult pimc_search(const Position &pos, const SearchOptions &opt)
+{
+    Position root(pos);
+    root.set_rules(FullGame);
+    if (!root.pieces(Hidden)) {
+        return search(root, opt);
+    }
+
+    SearchResult res;
+    Move moves[MAX_MOVES];
+    int n = 0;
+    for (Move mv : MoveList(root)) {
+        Position next(root);
+        if (mv.type() == Flipping || next.do_move(mv)) {
+            moves[n++] = mv;
+        }
+    }
+    if (n <= 1) {
+        res.best  = n ? moves[0] : Move(0);
+        res.score = n ? evaluate(root) : -MATE;
+        res.pv.assign(moves, moves + n);
+        return res;
+    }
+
+    unsigned threads = thread_count(opt.threads);
+    SearchOptions each(opt);
+    each.hashMB = std::max<size_t>(opt.hashMB / threads, 1);
+    SharedTable shared(opt.hashMB);
+    std::atomic<bool> settled(false);
+    std::vector<std::unique_ptr<Searcher>> searchers;
+    for (unsigned w = 0; w < threads; w += 1) {
+        searchers.emplace_back(new Searcher(each));
+        Searcher &s = *searchers.back();
+        s.budget    = Budget(opt.nodeLimit ? std::max<uint64_t>(opt.nodeLimit / threads, 1) : 0, opt.moveTime);
+        s.shared    = &shared;
+        s.halt      = &settled;
+    }
+
+    std::mutex lock;
+    std::vector<std::vector<int>> deals; // every root move's score, per deal
+    std::vector<char> spent(threads, 0); // out of budget
+    int best    = 0;
+    int shallow = MAX_PLY;
+    parallel_for(std::max(opt.samples, 1), threads, [&](size_t i, unsigned worker) {
+        Searcher &s = *searchers[worker];
+        if (settled || spent[worker]) {
+            return;
+        }
+        // Deal i is the same whichever thread gets it
+        pcg32 dice = rng_stream(i);
+        Piece dealt[SQUARE_NB];
+        deal(root, dice, dealt);
+        s.dealt   = dealt;
+        s.salt    = Key(dice()) << 32 | dice();
+        s.stopped = false;
+
+        Position start(root);
+        start.attach_history(s.keys);
+        int scores[MAX_MOVES];
+        int depth     = score_deal(s, start, moves, n, opt.depth, scores);
+        s.dealt       = nullptr;
+        spent[worker] = s.stopped && !settled;
+        if (depth == 0) {
+            return;
+        }
+        for (int j = 0; j < n; j += 1) {
+            scores[j] = std::min(OUTCOME_BOUND, std::max(-OUTCOME_BOUND, scores[j]));
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (settled) {
+            return;
+        }
+        deals.emplace_back(scores, scores + n);
+        shallow = std::min(shallow, depth);
+        if (settled_best(deals, n, best)) {
+            settled = true;
+        }
+    });
+
+    for (const std::unique_ptr<Searcher> &s : searchers) {
+        res.nodes += s->nodes;
+    }
+    res.samples = deals.size();
+    res.best    = moves[best];
+    res.pv      = { res.best };
+    if (!deals.empty()) {
+        int64_t sum = 0;
+        for (const std::vector<int> &d : deals) {
+            sum += d[best];
+        }
+        res.score = sum / int64_t(deals.size());
+        res.depth = shallow;
+    }
+    return res;
+}
@@ -0,0 +1,90 @@
+// Wakasagi: game search
+// ----------------------------------
+// Alpha-beta for the full game (Rules::FullGame), where the sides take turns.
+// Negamax principal variation search, deepened one ply at a time with an
+// aspiration window around the last score. Moves are tried in the order
+//   1. the transposition table's move
+//   2. captures, most valuable victim first
+//   3. the two killer moves of the ply
+//   4. everything else, by history score
+// and late quiet moves are searched shallower first. Captures are followed
+// to the end at the leaves (quiescence search). A position that came up
+// before in the line or in the game (see Position::attach_history()) is a
+// draw, and so is one past the fifty-move limit.
+//
+// A flip is a chance node: its score is the average over the pieces it may
+// reveal, weighted by how many of each are left in the bag. Star1 and Star2
+// pruning (Ballard) cut most of them short, see search.cpp.
+//
+// pimc_search() is the other way round the hidden pieces (perfect
+// information Monte Carlo): deal them out of the bag a number of times and
+// search every deal as an open game, where a flip reveals what was dealt.
+
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "lib/chess.h"
+#include "lib/types.h"
+
+#include <vector>
+
+// Scores are in the side to move's favour
+constexpr int MAX_PLY    = 128;
+constexpr int MATE       = 30000;
+constexpr int MATE_BOUND = MATE - MAX_PLY; // above this, a win in some plies
+
+struct SearchOptions {
+    int depth          = 64;   // --depth N
+    uint64_t moveTime  = 0;    // --movetime MS, 0 for none
+    uint64_t nodeLimit = 0;    // --nodes N, 0 for none
+    size_t hashMB      = 16;   // --hash MB
+    bool star          = true; // --no-star: average every flip outcome in full
+    int samples        = 32;   // --pimc K, deals for pimc_search()
+    unsigned threads   = 0;    // --threads N, for pimc_search(), 0 = all cores
+};
+
+// How the chance nodes went
+struct ChanceStats {
+    uint64_t nodes     = 0;
+    uint64_t star1Cuts = 0; // stopped partway through the outcomes
+    uint64_t star2Cuts = 0; // stopped by the probes alone
+};
+
+struct SearchResult {
+    Move best      = Move(0); // Move(0) if there is no move at all
+    int score      = 0;
+    int depth      = 0;       // of the last iteration that finished
+    uint64_t nodes = 0;
+    ChanceStats chances;
+    std::vector<Move> pv;
+    int samples    = 0;       // deals pimc_search() got through
+};
+
+/*
+ * Material and piece-square scores (kept by the position, see eval.h), the
+ * bag's average for every face-down piece, and mobility.
+ * @returns Score for the side to move
+ */
+int evaluate(const Position &pos);
+
+/*
+ * Finds the best move for the side to move, playing by FullGame rules
+ * whatever _pos_ is set to.
+ * @returns Always something from the first iteration on, even if the
+ *          budget runs out during a later one
+ */
+SearchResult search(const Position &pos, const SearchOptions &opt = SearchOptions());
+
+/*
+ * Deals the face-down pieces of _pos_ up to _opt.samples_ times, scores
+ * every move in every deal to _opt.depth_ on _opt.threads_ threads, and
+ * picks the best average. Stops dealing once that move is ahead of each
+ * other one by more than the deals disagree. Deals share the scores of
+ * positions with nothing face-down, which don't depend on the deal.
+ * --nodes is split evenly among the threads.
+ * @returns _score_ is the average, _depth_ the shallowest deal's and _pv_
+ *          just the move. Same as search() if nothing is face-down.
+ */
+SearchResult pimc_search(const Position &pos, const SearchOptions &opt = SearchOptions());
+
+#endif
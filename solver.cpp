@@ -1,5 +1,9 @@
 #include "solver.h"
 #include "lib/helper.h"
+#include "astar.h"
+#include "cache.h"
+#include "heuristic.h"
+#include "stats.h"
 #include <iostream>
 #include <queue>
 #include <vector>
@@ -8,6 +12,10 @@
 #include <string>
 #include <time.h>
 #include <typeinfo>
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <cstdlib>
 using namespace std;
 
 
@@ -24,163 +32,458 @@ using namespace std;
  * Good luck!
  */
 
-const int dr[4] = {0, 0, 1, -1}; 
-const int dc[4] = {1, -1, 0, 0};
-
-int bfs_general(Position &pos, Square start, Square end){
-    queue<pair<Square, int>> q;
-    Board all_pieces = pos.pieces();
-    uint64_t obstacle = all_pieces;
-    obstacle &= ~(1ull << start);
-    obstacle &= ~(1ull << end);
-
-    uint64_t visited = 0;
-    visited |= (1ull << start);
-    q.push({start, 0});
-
-    while(!q.empty()){
-        auto [cur, dist] = q.front();
-        q.pop();
-
-        int r = rank_of(cur), c = file_of(cur);
-        for(int i = 0; i < 4; i++){
-            int nr = r + dr[i], nc = c + dc[i];
-            if(nr < 0 || nr >= 4 || nc < 0 || nc >= 8) continue;
-            
-            Square next_sq = (Square)(nr * 8 + nc);
-            uint64_t next_mask = 1ull << next_sq;
-
-            if((obstacle & next_mask) || (visited & next_mask)) continue;
-            
-            if(next_sq == end){
-                return dist + 1;
+// Weights are in thousandths, f = g * WEIGHT_ONE + weight * h
+const int WEIGHT_ONE = 1000;
+
+/*
+ * Shortest way for the piece on _from_ to capture any red piece,
+ * moving through empty squares only. Empty if there is none.
+ */
+vector<Move> capture_route(Position &pos, Square from){
+    Piece p = pos.peek_piece_at(from);
+    Board occupied = pos.pieces() ^ from;
+    Board prey = 0;
+    for(Square rp: BoardView(pos.pieces(Red))){
+        if(p.type > pos.peek_piece_at(rp).type) prey |= rp;
+    }
+    if(prey == 0) return {};
+
+    Square parent[SQUARE_NB];
+    Square q[SQUARE_NB];
+    int head = 0, tail = 0;
+    Board visited = square_bb(from);
+    q[tail++] = from;
+
+    while(head < tail){
+        Square cur = q[head++];
+        Board attacks = attacks_bb(p.type, cur, occupied);
+        if(attacks & prey){
+            vector<Move> route;
+            route.push_back(Move(cur, Square(__builtin_ctz(attacks & prey))));
+            for(Square sq = cur; sq != from; sq = parent[sq]){
+                route.push_back(Move(parent[sq], sq));
             }
-            visited |= next_mask;
-            q.push({next_sq, dist + 1});
+            reverse(route.begin(), route.end());
+            return route;
+        }
+        for(Square next_sq: BoardView(attacks & ~occupied & ~visited)){
+            visited |= next_sq;
+            parent[next_sq] = cur;
+            q[tail++] = next_sq;
         }
     }
-
-    return INT32_MAX;
+    return {};
 }
 
-int bfs_chariot(Position &pos, Square start, Square end){
-    queue<pair<Square, int>> q;
-    Board all_pieces = pos.pieces();
-    uint32_t obstacle = all_pieces;
-    obstacle &= ~(1ull << start);
-    obstacle &= ~(1ull << end);
-
-    uint32_t visited = 0;
-    visited |= (1ull << start);
-    q.push({start, 0});
-
-    while(!q.empty()){
-        auto [cur, dist] = q.front();
-        q.pop();
-
-        int r = rank_of(cur), c = file_of(cur);
-        for(int i = 0; i < 4; i++){
-            int nr = r, nc = c;
-            while(true){
-                nr += dr[i];
-                nc += dc[i];
-                if(nr < 0 || nr >= 4 || nc < 0 || nc >= 8) break;
-
-                Square next_sq = (Square)(nr * 8 + nc);
-                uint32_t next_mask = 1ull << next_sq;
-
-                if (obstacle & next_mask) break;
-
-                if (visited & next_mask) continue;
-                
-                if(next_sq == end){
-                    return dist + 1;
-                }
-                visited |= next_mask;
-                q.push({next_sq, dist + 1});
+/*
+ * A quick, usually suboptimal, solution: keep sending whichever piece is
+ * closest to a capture to make it.
+ * @returns Whether it solved the puzzle
+ */
+bool greedy_solution(Position pos, vector<Move> &path){
+    while(pos.winner() != Black){
+        vector<Move> best;
+        for(Square bp: BoardView(pos.pieces(Black))){
+            vector<Move> route = capture_route(pos, bp);
+            if(!route.empty() && (best.empty() || route.size() < best.size())){
+                best = route;
             }
         }
+        if(best.empty()) return false;
+
+        for(Move mv: best){
+            if(!pos.do_move(mv)) return false;
+            path.push_back(mv);
+        }
     }
+    return true;
+}
+
+Budget::Budget(const SolverOptions &opt) : Budget(opt.nodeLimit, opt.moveTime) {}
 
-    return INT32_MAX;
+Budget::Budget(uint64_t nodeLimit, uint64_t moveTime) : nodeLimit(nodeLimit), moveTime(moveTime) {
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += moveTime / 1000;
+    deadline.tv_nsec += (moveTime % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
 }
 
-int find_table_dist(Position &pos){
-    vector<Square> blacks = BoardView(pos.pieces(Black)).to_vector();
-    vector<Square> reds = BoardView(pos.pieces(Red)).to_vector();
-    if(reds.size() == 0){
-        return 0;
+bool Budget::expired(uint64_t nodes) const {
+    if (nodeLimit && nodes >= nodeLimit) return true;
+    if (moveTime && nodes % NODES_PER_CHECK == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec > deadline.tv_sec
+            || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec);
     }
+    return false;
+}
 
-    int dist = INT32_MAX;
-    for(auto bp: blacks){
-        Piece p = pos.peek_piece_at(bp);
-        for(auto rp: reds){
-            if(p.type == Duck) continue;
-            if(p.type == Chariot){
-                dist = min(dist, bfs_chariot(pos, bp, rp));
-            }
-            else{
-                dist = min(dist, bfs_general(pos, bp, rp));
-            }
-        }
+// Everything an IDA* search carries around
+struct Search {
+    const SolverOptions &opt;
+    Budget budget;
+    unordered_map<Key, int> TT;
+    vector<Move> path;
+    int weight;
+    CaptureTable *captures = nullptr;
+    bool prune = false; // only follow relevant moves
+
+    uint64_t nodes = 0;
+    bool stopped = false;
+    Iteration it;
+
+    Search(const SolverOptions &opt) : opt(opt), budget(opt), weight(llround(opt.weight * WEIGHT_ONE)) {}
+
+    // Counts a node cut at _f_ and passes _f_ on
+    int cut(int f) {
+        int bucket = (f - it.threshold - 1) / WEIGHT_ONE;
+        it.exceeded[min(bucket, F_BUCKETS - 1)]++;
+        return f;
+    }
+};
+
+int classic_threshold(const Iteration &it, double /*growth*/) {
+    return it.minExceeded;
+}
+
+// Every cut node is the root of a subtree the next iteration will search
+// at least once, so take buckets until there are enough of them
+int cr_threshold(const Iteration &it, double growth) {
+    if (it.minExceeded >= INF) return INF;
+    uint64_t target = it.nodes * max(growth - 1.0, 0.0);
+    uint64_t sum = 0;
+    int last = 0;
+    for (int i = 0; i < F_BUCKETS; i++) {
+        if (!it.exceeded[i]) continue;
+        sum += it.exceeded[i];
+        last = i;
+        if (sum >= target) break;
     }
-    
-    return dist;
+    return max(it.minExceeded, it.threshold + (last + 1) * WEIGHT_ONE);
 }
 
+const NamedPolicy THRESHOLD_POLICIES[] = {
+    { "classic", classic_threshold },
+    { "cr", cr_threshold },
+    { nullptr, nullptr },
+};
 
-int dfs(Position &pos, int g, int threshold, vector<Move> &path, unordered_map<uint32_t, int> &table_mst, unordered_map<string, int> &TT) {
-    int reds = BoardView(pos.pieces(Red)).to_vector().size();
-    int h = reds + find_table_dist(pos);
-    int f = g + h;
-    if (f > threshold) return f;
+int dfs(Position &pos, HeuristicState &hs, int g, int threshold, Search &s) {
+    if (s.stopped) return INF;
+    s.nodes++;
+    STATS_INC(nodes);
+    if (s.budget.expired(s.nodes)) {
+        s.stopped = true;
+        return INF;
+    }
+
+    // Cheapest bound first; most nodes are cut before the dearer ones run.
+    // A cut returns the f it was cut with, which is still a valid bound.
+    int reds = pos.count(Red);
+    STATS_INC(tierCalls[0]);
+    int h = reds + STATS_TIMED(heuristicNs, manhattan_quiet_moves(pos));
+    int f = h >= INF ? INF : g * WEIGHT_ONE + s.weight * h;
+    if (f > threshold) {
+        STATS_INC(tierCutoffs[0]);
+        return h >= INF ? INF : s.cut(f); // INF: no black piece can capture any red
+    }
+
+    STATS_INC(tierCalls[1]);
+    h = max(h, reds + STATS_TIMED(heuristicNs, hs.quiet_moves(pos)));
+    f = h >= INF ? INF : g * WEIGHT_ONE + s.weight * h;
+    if (f > threshold) {
+        STATS_INC(tierCutoffs[1]);
+        return h >= INF ? INF : s.cut(f);
+    }
+
+    STATS_INC(tierCalls[2]);
+    h = max(h, STATS_TIMED(heuristicNs, capture_bound(pos, *s.captures)));
+    f = h >= INF ? INF : g * WEIGHT_ONE + s.weight * h;
+    if (f > threshold) {
+        STATS_INC(tierCutoffs[2]);
+        return h >= INF ? INF : s.cut(f);
+    }
+
+    STATS_INC(winnerCalls);
     if (pos.winner() == Black) return -1;
 
-    string key = pos.toFEN();
-    if (TT.find(key) != TT.end() && TT[key] <= g) return INT32_MAX;
-    TT[key] = g;
+    Key key = position_key(pos, s.opt.keyMode);
+    STATS_INC(ttProbes);
+    auto it = s.TT.find(key);
+    if (it != s.TT.end() && it->second <= g) {
+        STATS_INC(ttHits);
+        return INF;
+    }
+    STATS_INC(ttStores);
+    s.TT[key] = g;
+
+    Relevance rel;
+    if (s.prune) hs.relevance(pos, rel);
 
-    int min_next = INT32_MAX;
+    STATS_INC(expanded);
+    int min_next = INF;
     MoveList mvs(pos);
     for (Move mv : mvs) {
         Position next_pos(pos);
+        bool capture = pos.peek_piece_at(mv.to()).side != NO_COLOR;
+        if (s.prune && !capture && !rel.relevant(mv)) continue;
         if (!next_pos.do_move(mv)) continue;
-        path.push_back(mv);
-        int t = dfs(next_pos, g + 1, threshold, path, table_mst, TT);
+        STATS_INC(children);
+        HeuristicState next_hs(hs);
+        next_hs.do_move(mv, capture);
+        s.path.push_back(mv);
+        int t = dfs(next_pos, next_hs, g + 1, threshold, s);
         if (t == -1) return -1;
-        path.pop_back();
+        s.path.pop_back();
         if (t < min_next) min_next = t;
     }
     return min_next;
 }
 
-void resolve(Position &pos) {
-    struct timespec start_time, end_time;
-    clock_gettime(CLOCK_REALTIME, &start_time);
-    int random_num_below_42 = rng(42);
-    // info << pos;
-    unordered_map<uint32_t, int> table_mst;
+SolveResult solve(Position &pos, const SolverOptions &opt) {
+    SolveResult res;
+    Search s(opt);
+    CaptureTable captures(pos);
+    s.captures = &captures;
+
+    // With a budget, have something to show early
+    if (opt.moveTime || opt.nodeLimit) {
+        res.found = greedy_solution(pos, res.path);
+    }
+
     int reds = BoardView(pos.pieces(Red)).to_vector().size();
-    int threshold = reds + find_table_dist(pos);
-    unordered_map<string, int> TT;
+    int h = max(reds + find_table_dist(pos), capture_bound(pos, captures));
+
+    // A* first if asked to; when memory runs out, IDA* carries on from
+    // the bound A* got to
+    if (opt.astar && s.weight == WEIGHT_ONE && h < INF) {
+        int upper = res.found ? res.path.size() : INF;
+        AStarResult a = astar(pos, opt.astarMemory << 20, s.budget, upper);
+        s.nodes += a.nodes;
+        if (a.found) {
+            res.found = res.optimal = true;
+            res.path = a.path;
+            res.lowerBound = a.path.size();
+            res.nodes = s.nodes;
+            return res;
+        }
+        h = max(h, a.lowerBound);
+        if (!a.outOfMemory) {
+            s.stopped = true; // budget ran out, or nothing beats the greedy solution
+        }
+    }
+
+    // Every finished IDA* iteration proves a higher lower bound.
+    // With weight w, f <= w * (g + h) along any path, so an optimal
+    // solution fits once the threshold reaches w * optimal, and whatever
+    // is found by then costs at most that.
+    //
+    // A policy may set the threshold past what the last iteration proved.
+    // A solution found there has to be checked: search again below its
+    // own f, until nothing shorter turns up.
+    int bound = h >= INF ? INF : s.weight * h; // no solution has a smaller w * length
+    int threshold = bound;
+    bool checking = false;
+    int iteration = 0;
     while (true) {
-        vector<Move> path;
-        int t = dfs(pos, 0, threshold, path, table_mst, TT);
-        if (t == -1){
-            clock_gettime(CLOCK_REALTIME, &end_time);
-            double wall_clock_in_seconds =(double)((end_time.tv_sec + end_time.tv_nsec * (1e-9))
-                                             - (double)(start_time.tv_sec + start_time.tv_nsec * (1e-9)));
-
-            info << wall_clock_in_seconds << "\n";
-            info << path.size() << "\n";
-
-            for(Move mv: path){
-                info << mv;
+        if (bound >= INF) {
+            res.lowerBound = INF; // unsolvable
+            break;
+        }
+        res.lowerBound = (bound + s.weight - 1) / s.weight;
+        if (res.found && (long)res.path.size() * WEIGHT_ONE <= (long)s.weight * res.lowerBound) {
+            break; // already within the bound
+        }
+
+        if (s.stopped) break;
+
+        // With --prune, relevant moves only first. That often finds the
+        // solution in the last iteration with a fraction of the work; when
+        // it doesn't, the full pass at the same threshold keeps the search
+        // exact.
+        int t = INF;
+        for (int pass = opt.prune ? 0 : 1; pass < 2 && t != -1 && !s.stopped; pass++) {
+            STATS_BEGIN(snapshot);
+            s.prune = pass == 0;
+            s.path.clear();
+            s.it = Iteration();
+            s.it.threshold = threshold;
+            uint64_t before = s.nodes;
+            HeuristicState hs(pos);
+            t = dfs(pos, hs, 0, threshold, s);
+            s.it.nodes = s.nodes - before;
+            s.TT.clear();
+            STATS_REPORT(snapshot, iteration, s.prune ? "pruned" : "full", threshold, t);
+        }
+        iteration++;
+        if (t == -1) {
+            if (!res.found || s.path.size() < res.path.size()) res.path = s.path;
+            res.found = true;
+            if (threshold <= bound) break; // nothing below it was missed
+            threshold = (int)res.path.size() * WEIGHT_ONE - 1; // anything shorter?
+            checking = true;
+            continue;
+        }
+        if (s.stopped) break;
+
+        bound = max(bound, t);
+        s.it.minExceeded = t;
+        if (!checking) threshold = max(bound, opt.policy(s.it, opt.growth));
+    }
+    if (res.found) res.lowerBound = min(res.lowerBound, (int)res.path.size());
+
+    res.optimal = res.found && res.lowerBound == (int)res.path.size();
+    res.nodes = s.nodes;
+    return res;
+}
+
+bool parse_count(const string &s, uint64_t &out) {
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s.c_str(), &end, 10);
+    if (s.empty() || s[0] == '-' || *end || errno) return false;
+    out = v;
+    return true;
+}
+
+bool parse_real(const string &s, double &out) {
+    char *end;
+    errno = 0;
+    double v = strtod(s.c_str(), &end);
+    if (s.empty() || *end || errno || !isfinite(v)) return false;
+    out = v;
+    return true;
+}
+
+bool parse_options(int argc, char *argv[], SolverOptions &opt) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        // options that take a value
+        if (arg == "--cache" || arg == "--cache-slots" || arg == "--movetime" || arg == "--nodes"
+            || arg == "--weight" || arg == "--astar-mem" || arg == "--policy" || arg == "--growth"
+            || arg == "--seed") {
+            if (i + 1 >= argc) {
+                error << "Option \"" << arg << "\" needs a value\n";
+                return false;
+            }
+            string value = argv[++i];
+            bool real = arg == "--growth" || arg == "--weight";
+            bool count = !real && arg != "--cache" && arg != "--policy";
+            uint64_t n = 0;
+            double x = 0;
+            if ((count && !parse_count(value, n)) || (real && !parse_real(value, x))) {
+                error << "Bad value \"" << value << "\" for \"" << arg << "\"\n";
+                return false;
+            }
+            if (arg == "--cache") {
+                opt.cacheFile = value;
+            }
+            else if (arg == "--cache-slots") {
+                opt.cacheSlots = n;
+            }
+            else if (arg == "--movetime") {
+                opt.moveTime = n;
+            }
+            else if (arg == "--astar-mem") {
+                opt.astarMemory = n;
+            }
+            else if (arg == "--policy") {
+                const NamedPolicy *p = THRESHOLD_POLICIES;
+                while (p->name && value != p->name) p++;
+                if (!p->name) {
+                    error << "Unknown threshold policy \"" << value << "\"\n";
+                    return false;
+                }
+                opt.policy = p->policy;
+            }
+            else if (arg == "--growth") {
+                opt.growth = x;
+            }
+            else if (arg == "--seed") {
+                seed_rng(n);
+            }
+            else if (arg == "--weight") {
+                opt.weight = x;
+                if (opt.weight < 1.0 || opt.weight > 10.0) {
+                    error << "Weight must be between 1 and 10\n";
+                    return false;
+                }
             }
-            return;
+            else {
+                opt.nodeLimit = n;
+            }
+        }
+        else if (arg == "--symmetry") {
+            opt.keyMode = CanonicalKey;
+        }
+        else if (arg == "--astar") {
+            opt.astar = true;
+        }
+        else if (arg == "--prune") {
+            opt.prune = true;
+        }
+        else {
+            error << "Unknown option \"" << arg << "\"\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_solution(const struct timespec &start_time, const SolveResult &res) {
+    struct timespec end_time;
+    clock_gettime(CLOCK_REALTIME, &end_time);
+    double wall_clock_in_seconds =(double)((end_time.tv_sec + end_time.tv_nsec * (1e-9))
+                                     - (double)(start_time.tv_sec + start_time.tv_nsec * (1e-9)));
+
+    info << wall_clock_in_seconds << "\n";
+    info << res.path.size() << "\n";
+
+    for(Move mv: res.path){
+        info << mv;
+    }
+    if (!res.optimal) {
+        // no worse than this many times the optimal length
+        double ratio = res.lowerBound ? (double)res.path.size() / res.lowerBound : 1.0;
+        info << "LOWERBOUND " << res.lowerBound << " RATIO " << ratio << "\n";
+    }
+}
+
+void resolve(Position &pos, const SolverOptions &opt) {
+    struct timespec start_time;
+    clock_gettime(CLOCK_REALTIME, &start_time);
+    int random_num_below_42 = rng(42);
+    // info << pos;
+
+    // Solved before?
+    SolutionCache cache;
+    if (!opt.cacheFile.empty()) {
+        cache.open(opt.cacheFile, opt.cacheSlots);
+    }
+    SolveResult res;
+    if (cache.probe(pos, res.path)) {
+        res.found = res.optimal = true;
+        res.lowerBound = res.path.size();
+        print_solution(start_time, res);
+        return;
+    }
+
+    res = solve(pos, opt);
+    if (!res.found) {
+        if (res.lowerBound >= INF) {
+            error << "No solution.\n";
+        }
+        else {
+            error << "No solution found, at least " << res.lowerBound << " moves.\n";
         }
-        threshold = t;
-        TT.clear();
+        return;
+    }
+    if (res.optimal) {
+        cache.store(pos, res.path);
     }
+    print_solution(start_time, res);
 }
@@ -10,7 +10,145 @@
 #include "lib/helper.h"
 #include "lib/movegen.h"
 #include "lib/types.h"
+#include "symmetry.h"
 
-void resolve(Position &pos);
+#include <ctime>
+
+// Exceeded f-values kept per IDA* iteration, one bucket per move of g
+constexpr int F_BUCKETS = 64;
+
+/*
+ * What one IDA* iteration saw, for picking the next threshold.
+ */
+struct Iteration {
+    int threshold;
+    int minExceeded;              // smallest f above the threshold, INF if none
+    uint64_t nodes;               // searched in this iteration
+    uint64_t exceeded[F_BUCKETS]; // cut nodes by f above the threshold, the last bucket takes the rest
+};
+
+/*
+ * Picks the next IDA* threshold. Anything from minExceeded up is correct;
+ * going higher means fewer iterations but a solution that may need proving.
+ * @param   it      The iteration that just failed
+ * @param   growth  How many times more nodes the next one should search
+ */
+using ThresholdPolicy = int (*)(const Iteration &it, double growth);
+
+// The minimum exceeded f, as plain IDA* does
+int classic_threshold(const Iteration &it, double /*growth*/);
+
+// IDA*-CR: far enough that about _growth_ times the nodes get expanded
+int cr_threshold(const Iteration &it, double growth);
+
+struct NamedPolicy {
+    const char *name;
+    ThresholdPolicy policy;
+};
+
+// For --policy, ends with { nullptr, nullptr }
+extern const NamedPolicy THRESHOLD_POLICIES[];
+
+/*
+ * Solver knobs, set from the command line.
+ */
+struct SolverOptions {
+    KeyMode keyMode = ExactKey;  // --symmetry: mirror images share TT entries
+
+    std::string cacheFile;       // --cache FILE: solutions kept between runs
+    size_t cacheSlots = 1 << 16; // --cache-slots N: size of a new cache file
+
+    // Budgets, 0 for none. With a budget the solver runs anytime: it finds
+    // a quick solution first and improves it until it is proven optimal or
+    // the budget runs out.
+    uint64_t moveTime  = 0;      // --movetime MS
+    uint64_t nodeLimit = 0;      // --nodes N
+
+    // Weighted IDA*: solutions are at most _weight_ times longer than
+    // optimal, in exchange for a much smaller search
+    double weight = 1.0;         // --weight W
+
+    // A* instead of IDA*, falling back to IDA* when memory runs out.
+    // Ignored with a weight.
+    bool astar = false;          // --astar
+    size_t astarMemory = 256;    // --astar-mem MB
+
+    // Try only the moves that bring a piece closer to a red first,
+    // everything else only if that finds nothing. Every iteration without
+    // a solution pays for both passes: on the corpus it saves nodes but
+    // not time, so it is off unless asked for.
+    bool prune = false;          // --prune
+
+    // How IDA* raises its threshold, see THRESHOLD_POLICIES
+    ThresholdPolicy policy = classic_threshold; // --policy NAME
+    double growth = 2.0;                        // --growth G, for cr
+};
+
+/*
+ * What the solver came up with.
+ */
+struct SolveResult {
+    std::vector<Move> path;
+    bool found   = false;
+    bool optimal = false; // path is proven to be as short as possible
+    int lowerBound = 0;   // no solution is shorter than this
+    uint64_t nodes = 0;
+};
+
+// Bigger than any real distance or bound, small enough to add to
+constexpr int INF = 1 << 30;
+
+// Budgets check the clock once every this many nodes
+constexpr uint64_t NODES_PER_CHECK = 1024;
+
+/*
+ * The time and node limits of one solve().
+ */
+struct Budget {
+    uint64_t nodeLimit;
+    uint64_t moveTime;
+    struct timespec deadline; // CLOCK_MONOTONIC
+
+    Budget(const SolverOptions &opt);
+    Budget(uint64_t nodeLimit, uint64_t moveTime);
+
+    /*
+     * Cheap enough to call on every node.
+     * @param   nodes   Nodes searched so far
+     */
+    bool expired(uint64_t nodes) const;
+};
+
+/*
+ * Lower bound on the quiet moves black has to make before the first capture,
+ * INF if no black piece can capture any red piece.
+ * pieces(Red) plus this is the search heuristic.
+ */
+int find_table_dist(Position &pos);
+
+/*
+ * Reads solver options from the command line. --seed S goes straight to
+ * seed_rng().
+ * @returns false if an option is unknown or malformed
+ */
+bool parse_options(int argc, char *argv[], SolverOptions &opt);
+
+/*
+ * The whole of _s_ as a number, for option values: "12z", "-1" (a count)
+ * or "inf" (a real) don't parse.
+ * @returns false, leaving _out_ alone, if _s_ isn't one
+ */
+bool parse_count(const std::string &s, uint64_t &out);
+bool parse_real(const std::string &s, double &out);
+
+/*
+ * Solves the puzzle without printing anything.
+ */
+SolveResult solve(Position &pos, const SolverOptions &opt = SolverOptions());
+
+/*
+ * Solves the puzzle and prints the answer.
+ */
+void resolve(Position &pos, const SolverOptions &opt = SolverOptions());
 
 #endif
\ No newline at end of file
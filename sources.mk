@@ -6,4 +6,4 @@
 CHINESE = 1
 
 # +-- Add your own sources here, if any --+
-ADD_SOURCES = solver.cpp
\ No newline at end of file
+ADD_SOURCES = solver.cpp symmetry.cpp cache.cpp astar.cpp heuristic.cpp stats.cpp bench.cpp perf.cpp generator.cpp validator.cpp record.cpp search.cpp mcts.cpp
\ No newline at end of file
@@ -0,0 +1,49 @@
+// Wakasagi: search statistics
+// ----------------------------------
+
+#include "stats.h"
+
+#if WAKASAGI_STATS
+
+#include "lib/cdc.h"
+
+#include <cstdio>
+
+thread_local Stats stats;
+
+void stats_report(const Stats &before, uint64_t startNs, int iteration, const char *pass, int threshold, int result)
+{
+    const Stats &now = stats;
+    uint64_t expanded = now.expanded - before.expanded;
+    uint64_t children = now.children - before.children;
+    double ebf        = expanded ? (double)children / expanded : 0.0;
+
+    char line[1024];
+    int n = snprintf(line, sizeof(line),
+        "{\"iteration\":%d,\"pass\":\"%s\",\"threshold\":%d,\"result\":%d,"
+        "\"ms\":%.3f,\"nodes\":%llu,\"expanded\":%llu,\"ebf\":%.3f,"
+        "\"tt\":{\"probes\":%llu,\"hits\":%llu,\"stores\":%llu},\"winner\":%llu,"
+        "\"heuristic\":{\"ms\":%.3f,\"calls\":[",
+        iteration, pass, threshold, result,
+        (stats_clock() - startNs) / 1e6,
+        (unsigned long long)(now.nodes - before.nodes),
+        (unsigned long long)expanded, ebf,
+        (unsigned long long)(now.ttProbes - before.ttProbes),
+        (unsigned long long)(now.ttHits - before.ttHits),
+        (unsigned long long)(now.ttStores - before.ttStores),
+        (unsigned long long)(now.winnerCalls - before.winnerCalls),
+        (now.heuristicNs - before.heuristicNs) / 1e6);
+    for (int i = 0; i < STATS_TIERS; i += 1) {
+        n += snprintf(line + n, sizeof(line) - n, "%s%llu", i ? "," : "",
+                      (unsigned long long)(now.tierCalls[i] - before.tierCalls[i]));
+    }
+    n += snprintf(line + n, sizeof(line) - n, "],\"cutoffs\":[");
+    for (int i = 0; i < STATS_TIERS; i += 1) {
+        n += snprintf(line + n, sizeof(line) - n, "%s%llu", i ? "," : "",
+                      (unsigned long long)(now.tierCutoffs[i] - before.tierCutoffs[i]));
+    }
+    snprintf(line + n, sizeof(line) - n, "]}}\n");
+    error << line << std::flush;
+}
+
+#endif
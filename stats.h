@@ -0,0 +1,82 @@
+// Wakasagi: search statistics
+// ----------------------------------
+// Build with `make stats` (-DWAKASAGI_STATS=1) to count what the search does
+// and get a JSON line on stderr for every IDA* pass. In normal builds every
+// STATS_* macro expands to nothing, so the search pays nothing for them.
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+
+#ifndef WAKASAGI_STATS
+#define WAKASAGI_STATS 0
+#endif
+
+// Heuristic tiers, cheapest first (see heuristic.h)
+constexpr int STATS_TIERS = 3;
+
+struct Stats {
+    uint64_t nodes;
+    uint64_t expanded;              // nodes that generated moves
+    uint64_t children;              // legal moves made from them
+    uint64_t ttProbes;
+    uint64_t ttHits;
+    uint64_t ttStores;
+    uint64_t winnerCalls;
+    uint64_t tierCalls[STATS_TIERS];
+    uint64_t tierCutoffs[STATS_TIERS];
+    uint64_t heuristicNs;           // time spent in all tiers
+};
+
+#if WAKASAGI_STATS
+
+#include <ctime>
+
+// One set per thread, so parallel searches don't fight over the counters
+extern thread_local Stats stats;
+
+inline uint64_t stats_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+template<typename F>
+inline auto stats_timed(uint64_t &counter, F f) -> decltype(f())
+{
+    uint64_t start = stats_clock();
+    auto value     = f();
+    counter += stats_clock() - start;
+    return value;
+}
+
+/*
+ * Prints what happened since _before_ as one JSON line on stderr.
+ * @param   before      A copy of the counters taken when the pass started
+ * @param   startNs     stats_clock() when the pass started
+ * @param   iteration   Counts from 0
+ * @param   pass        "pruned" or "full"
+ * @param   threshold   The f-threshold of the pass
+ * @param   result      What the pass returned: -1 if solved, else the next f
+ */
+void stats_report(const Stats &before, uint64_t startNs, int iteration, const char *pass, int threshold, int result);
+
+#define STATS_INC(counter)          (stats.counter += 1)
+#define STATS_ADD(counter, n)       (stats.counter += (n))
+#define STATS_TIMED(counter, expr)  stats_timed(stats.counter, [&] { return (expr); })
+#define STATS_BEGIN(name)           const Stats name = stats; const uint64_t name##Ns = stats_clock()
+#define STATS_REPORT(name, ...)     stats_report(name, name##Ns, __VA_ARGS__)
+
+#else
+
+#define STATS_INC(counter)          ((void)0)
+#define STATS_ADD(counter, n)       ((void)0)
+#define STATS_TIMED(counter, expr)  (expr)
+#define STATS_BEGIN(name)           ((void)0)
+#define STATS_REPORT(name, ...)     ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+// Wakasagi: board symmetries
+// ----------------------------------
+
+#include "symmetry.h"
+
+constexpr int SYMMETRY_NB = sizeof(ALL_SYMMETRIES) / sizeof(ALL_SYMMETRIES[0]);
+
+// Hashes every mirror image of the position at once,
+// keys[i] belongs to ALL_SYMMETRIES[i]
+static void mirrored_keys(const Position &pos, Key keys[SYMMETRY_NB])
+{
+    Key side = pos.due_up() == Red ? ZobristSide : 0;
+    keys[0]  = pos.key(); // identity, kept incrementally
+    for (int i = 1; i < SYMMETRY_NB; i += 1) {
+        keys[i] = side;
+    }
+
+    auto add = [&](const Key psq[SQUARE_NB], Board b) {
+        if (b == 0) {
+            return;
+        }
+        for (int i = 1; i < SYMMETRY_NB; i += 1) {
+            for (Square sq : BoardView(mirror(b, ALL_SYMMETRIES[i]))) {
+                keys[i] ^= psq[sq];
+            }
+        }
+    };
+
+    for (Color c : { Black, Red }) {
+        for (PieceType pt = General; pt < SHOWN_PIECE_TYPE_NB; pt += 1) {
+            add(ZobristPsq[c][pt], pos.pieces(c, pt));
+        }
+    }
+    add(ZobristPsq[Mystery][Hidden], pos.pieces(Hidden));
+}
+
+Key mirrored_key(const Position &pos, Symmetry s)
+{
+    if (s == SYM_IDENTITY) {
+        return pos.key();
+    }
+
+    Key key = pos.due_up() == Red ? ZobristSide : 0;
+    for (Square sq : BoardView(pos.pieces())) {
+        Piece p = pos.peek_piece_at(sq);
+        key ^= ZobristPsq[p.side][p.type][mirror(sq, s)];
+    }
+    return key;
+}
+
+Key canonical_key(const Position &pos, Symmetry *sym)
+{
+    Key keys[SYMMETRY_NB];
+    mirrored_keys(pos, keys);
+
+    int best = 0;
+    for (int i = 1; i < SYMMETRY_NB; i += 1) {
+        if (keys[i] < keys[best]) {
+            best = i;
+        }
+    }
+    if (sym != nullptr) {
+        *sym = ALL_SYMMETRIES[best];
+    }
+    return keys[best];
+}
@@ -0,0 +1,83 @@
+// Wakasagi: board symmetries
+// ----------------------------------
+// The 4x8 board looks the same mirrored left-right, top-bottom, or both.
+// Nothing in the HW1 puzzle cares about orientation, so mirrored positions
+// take exactly as many moves to solve.
+
+#ifndef SYMMETRY_H
+#define SYMMETRY_H
+
+#include "lib/chess.h"
+#include "lib/types.h"
+
+/*
+ * A symmetry of the board, stored as the XOR mask it applies to a Square.
+ * (files are the low 3 bits, ranks the next 2)
+ * Every symmetry is its own inverse.
+ */
+enum Symmetry : int {
+    SYM_IDENTITY = 0,
+    SYM_FILES    = 7,  // A <-> H
+    SYM_RANKS    = 24, // 1 <-> 4
+    SYM_BOTH     = 31, // half turn
+};
+
+constexpr Symmetry ALL_SYMMETRIES[] = { SYM_IDENTITY, SYM_FILES, SYM_RANKS, SYM_BOTH };
+
+/*
+ * How positions are keyed in transposition tables and solution caches.
+ *   ExactKey       Position::key()
+ *   CanonicalKey   The smallest key among all mirror images of the position
+ */
+enum KeyMode { ExactKey, CanonicalKey };
+
+/*
+ * Mirrors a square.
+ */
+constexpr Square mirror(Square sq, Symmetry s) { return Square(sq ^ s); }
+
+/*
+ * Mirrors a bitboard.
+ * Each rank is a byte, so swapping ranks is a byte swap and swapping files
+ * reverses the bits inside every byte.
+ */
+constexpr Board mirror(Board b, Symmetry s)
+{
+    if (s & SYM_FILES) {
+        b = ((b >> 1) & 0x55555555U) | ((b & 0x55555555U) << 1);
+        b = ((b >> 2) & 0x33333333U) | ((b & 0x33333333U) << 2);
+        b = ((b >> 4) & 0x0F0F0F0FU) | ((b & 0x0F0F0F0FU) << 4);
+    }
+    if (s & SYM_RANKS) {
+        b = __builtin_bswap32(b);
+    }
+    return b;
+}
+
+/*
+ * Mirrors a move. Use this to map moves found on a mirrored position back.
+ */
+inline Move mirror(Move mv, Symmetry s) { return Move(mirror(mv.from(), s), mirror(mv.to(), s)); }
+
+/*
+ * Hashes the position as if it was mirrored by _s_.
+ * Equals pos.key() for SYM_IDENTITY.
+ */
+Key mirrored_key(const Position &pos, Symmetry s);
+
+/*
+ * The canonical key: the smallest key among all mirror images of _pos_.
+ * @param   sym Optional, receives the symmetry that maps _pos_ onto its
+ *              canonical image
+ */
+Key canonical_key(const Position &pos, Symmetry *sym = nullptr);
+
+/*
+ * Keys a position according to _mode_.
+ */
+inline Key position_key(const Position &pos, KeyMode mode)
+{
+    return mode == CanonicalKey ? canonical_key(pos) : pos.key();
+}
+
+#endif
@@ -0,0 +1,181 @@
+// Wakasagi: batch validation
+// ----------------------------------
+
+#include "validator.h"
+#include "lib/cdc.h"
+#include "lib/chess.h"
+#include "parallel.h"
+#include "record.h"
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static bool parse_square(const char *s, Square &sq)
+{
+    if (s[0] < 'A' || s[0] > 'H' || s[1] < '1' || s[1] > '4') {
+        return false;
+    }
+    sq = make_square(File(s[0] - 'A'), Rank(s[1] - '1'));
+    return true;
+}
+
+size_t parse_move(const char *s, const char *end, Move &mv)
+{
+    Square from, to;
+    if (end - s >= 10 && !memcmp(s, "MOVE ", 5) && s[7] == ' ' &&
+        parse_square(s + 5, from) && parse_square(s + 8, to)) {
+        mv = Move(from, to);
+        return 10;
+    }
+    if (end - s >= 7 && !memcmp(s, "FLIP ", 5) && parse_square(s + 5, from)) {
+        mv = Move(from, from);
+        return 7;
+    }
+    return 0;
+}
+
+enum Verdict { GOOD, ILLEGAL, BAD_MOVE, DIDNT_WIN, NO_POSITION, VERDICT_NB };
+
+static const char *const VERDICT_NAMES[VERDICT_NB] = { "Good job!", "ILLEGAL", "BAD MOVE", "DIDN'T WIN", "NO POSITION" };
+
+struct Record {
+    const char *begin, *end; // from the FEN or @N line up to the next record
+    Verdict verdict;
+    int moves;               // made before the verdict
+};
+
+static const char *line_end(const char *s, const char *end)
+{
+    const char *nl = static_cast<const char *>(memchr(s, '\n', end - s));
+    return nl ? nl : end;
+}
+
+// Same rules as the single puzzle validator in wakasagihime.cpp
+static void validate(Record &r, const RecordReader *positions)
+{
+    const char *fenEnd = line_end(r.begin, r.end);
+    Position pos;
+    r.moves = 0;
+    if (*r.begin == '@') {
+        size_t n = strtoull(r.begin + 1, nullptr, 10);
+        if (!positions || n >= positions->records()) {
+            r.verdict = NO_POSITION;
+            return;
+        }
+        unpack_record((*positions)[n], pos);
+    } else {
+        pos = Position(std::string_view(r.begin, fenEnd - r.begin));
+    }
+
+    r.verdict = GOOD;
+    for (const char *s = fenEnd; s < r.end && pos.winner() == NO_COLOR; s = line_end(s, r.end) + 1) {
+        while (s < r.end && (*s == ' ' || *s == '\t' || *s == '\n')) {
+            s += 1;
+        }
+        if (s >= r.end || (memcmp(s, "MOVE", 4) && memcmp(s, "FLIP", 4))) {
+            continue; // times, lengths and such
+        }
+        Move mv;
+        if (!parse_move(s, r.end, mv)) {
+            r.verdict = BAD_MOVE;
+            return;
+        }
+        if (!pos.do_move(mv)) {
+            r.verdict = ILLEGAL;
+            return;
+        }
+        r.moves += 1;
+    }
+    if (pos.winner() != Black) {
+        r.verdict = DIDNT_WIN;
+    }
+}
+
+// A FEN line has its ranks separated by slashes, solver output doesn't.
+// "@N" stands for position N of the record file instead.
+static bool is_fen_line(const char *s, const char *end)
+{
+    if (s < end && *s == '@') {
+        return s + 1 < end && s[1] >= '0' && s[1] <= '9';
+    }
+    return memchr(s, '/', line_end(s, end) - s) != nullptr;
+}
+
+int batch_validate(const char *path, unsigned threads, const char *positionsPath)
+{
+    RecordReader positions;
+    if (positionsPath && !positions.open(positionsPath)) {
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        error << "Can't open \"" << path << "\"\n";
+        return 1;
+    }
+    const char *data = "";
+    if (st.st_size > 0) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            error << "Can't map \"" << path << "\"\n";
+            close(fd);
+            return 1;
+        }
+        data = static_cast<const char *>(map);
+    }
+    const char *end = data + st.st_size;
+
+    struct timespec start, stop;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    std::vector<Record> records;
+    for (const char *s = data; s < end; s = line_end(s, end) + 1) {
+        if (is_fen_line(s, end)) {
+            if (!records.empty()) {
+                records.back().end = s;
+            }
+            records.push_back({ s, end, GOOD, 0 });
+        }
+    }
+
+    parallel_for(records.size(), thread_count(threads), [&](size_t i, unsigned) {
+        validate(records[i], positionsPath ? &positions : nullptr);
+    });
+
+    uint64_t count[VERDICT_NB] = {};
+    uint64_t moves             = 0;
+    std::string out;
+    for (size_t i = 0; i < records.size(); i += 1) {
+        const Record &r = records[i];
+        count[r.verdict] += 1;
+        moves += r.moves;
+        out += std::to_string(i + 1) + " " + std::string(r.begin, line_end(r.begin, r.end)) + " | " +
+               VERDICT_NAMES[r.verdict];
+        if (r.verdict != GOOD) {
+            out += " after " + std::to_string(r.moves) + " moves";
+        }
+        out += '\n';
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    double ms = (stop.tv_sec - start.tv_sec) * 1e3 + (stop.tv_nsec - start.tv_nsec) / 1e6;
+    fprintf(stderr, "%zu records, %llu moves in %.3f ms: %llu good, %llu illegal, %llu bad moves, %llu didn't win, %llu missing\n",
+            records.size(), (unsigned long long)moves, ms, (unsigned long long)count[GOOD],
+            (unsigned long long)count[ILLEGAL], (unsigned long long)count[BAD_MOVE],
+            (unsigned long long)count[DIDNT_WIN], (unsigned long long)count[NO_POSITION]);
+
+    if (st.st_size > 0) {
+        munmap(const_cast<char *>(data), st.st_size);
+    }
+    close(fd);
+    return count[GOOD] == records.size() ? 0 : 2;
+}
@@ -0,0 +1,37 @@
+// Wakasagi: batch validation
+// ----------------------------------
+// `wakabench validate FILE [--threads N] [--positions RECORDS]` checks many
+// solutions at once, where valisagi checks one.
+// The file holds records, each a FEN line followed by the solver's output
+// for it: MOVE/FLIP lines are replayed, anything else (times, lengths,
+// LOWERBOUND lines) is skipped. So this works:
+//
+//   while read fen; do echo "$fen"; echo "$fen" | ./wakasagi; done < puzzles > batch
+//   ./wakabench validate batch
+//
+// With --positions, a record may start with "@N" instead of a FEN, for
+// position N (from 0) of a record file (see record.h).
+
+#ifndef VALIDATOR_H
+#define VALIDATOR_H
+
+#include "lib/types.h"
+
+#include <cstddef>
+
+/*
+ * Reads "MOVE A3 A4" or "FLIP B2" from the start of [s, end).
+ * Doesn't allocate, unlike operator>>(std::istream&, Move&).
+ * @returns Characters read, 0 if there is no well-formed move there
+ */
+size_t parse_move(const char *s, const char *end, Move &mv);
+
+/*
+ * Validates every record in _path_ on _threads_ threads (0 = all cores).
+ * Prints one verdict per record, in file order, and a summary on stderr.
+ * @param   positionsPath   Record file for "@N" lines, or nullptr
+ * @returns 0 if all of them win, 1 if a file can't be read, 2 otherwise
+ */
+int batch_validate(const char *path, unsigned threads, const char *positionsPath = nullptr);
+
+#endif
@@ -7,6 +7,7 @@
 #include "lib/marisa.h"
 #include "lib/types.h"
 #include "solver.h"
+#include "bench.h"
 
 // Girls are preparing...
 __attribute__((constructor)) void prepare()
@@ -31,11 +32,18 @@ __attribute__((constructor)) void prepare()
     // Prepare magic
     init_magic<Chariot>(chariotTable, chariotMagics);
     init_magic<Cannon>(cannonTable, cannonMagics);
+
+    // Prepare hash keys
+    init_zobrist();
 }
 
 // le fishe
-int main()
+int main(int argc, char *argv[])
 {
+#if WAKASAGI_BENCH
+    return bench_main(argc, argv);
+#endif
+
     // Read test case
     std::string fen;
     std::getline(std::cin, fen);
@@ -45,7 +53,11 @@ int main()
 
 #if !(WAKASAGI_VALIDATE)
     // It's up to you! See solver.cpp
-    resolve(pos);
+    SolverOptions opt;
+    if (!parse_options(argc, argv, opt)) {
+        return 1;
+    }
+    resolve(pos, opt);
 #else
     // HW1 Validate mode!
     Move mv;